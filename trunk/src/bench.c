@@ -0,0 +1,804 @@
+/* Plasma OCR - an OCR engine
+ *
+ * bench.c - microbenchmarks for the hot spots
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/* Usage: bench [name...]
+ * Without arguments, runs all the benchmarks.
+ * Build with optimization to get meaningful numbers, e.g.
+ *     make bench CFLAGS=-O2 BASEOBJDIR=obj-O2
+ */
+
+
+#include "common.h"
+#include "shiftcut.h"
+#include "pattern.h"
+#include "library.h"
+#include "editdist.h"
+#include "pqindex.h"
+#include "thinning.h"
+#include "bitmaps.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+/* Results are summed here so that the compiler can't throw the work away. */
+static volatile long sink;
+
+
+static double seconds(void)
+{
+    return (double) clock() / CLOCKS_PER_SEC;
+}
+
+
+static void report(const char *what, double time, long units)
+{
+    printf("    %-32s %8.3f s  %8.2f ns/item\n", what, time, time * 1e9 / units);
+}
+
+
+/* ______________________________   fingerprints   __________________________________ */
+
+
+static void bench_fingerprints(void)
+{
+    int n = 100000;
+    int rounds = 200;
+    Fingerprint *f = MALLOC(Fingerprint, n);
+    long *d = MALLOC(long, n);
+    long check1 = 0, check2 = 0;
+    double t, scalar, batch;
+    int i, j, r;
+
+    srand(57);
+    for (i = 0; i < n; i++)
+        for (j = 0; j < (int) sizeof(Fingerprint); j++)
+            f[i][j] = rand() % 256;
+
+    t = seconds();
+    for (r = 0; r < rounds; r++)
+        for (i = 0; i < n; i++)
+            check1 += fingerprint_distance_squared(f[r], f[i]);
+    scalar = seconds() - t;
+
+    t = seconds();
+    for (r = 0; r < rounds; r++)
+    {
+        fingerprint_distances_squared(f[r], f, n, d);
+        for (i = 0; i < n; i++)
+            check2 += d[i];
+    }
+    batch = seconds() - t;
+
+    if (check1 != check2)
+    {
+        fprintf(stderr, "fingerprint distances don't match\n");
+        exit(1);
+    }
+    sink += check1;
+
+    report("fingerprint_distance_squared", scalar, (long) n * rounds);
+    report("fingerprint_distances_squared", batch, (long) n * rounds);
+    printf("    speedup: %.2f\n", scalar / batch);
+
+    FREE(f);
+    FREE(d);
+}
+
+
+/* ______________________________   frozen patterns   __________________________________ */
+
+
+#define BENCH_LIBRARY "charlibs/cyr1.lib"
+
+
+/* Collect at least `n' patterns by opening the library again and again. */
+static Pattern *load_patterns(int n, int *count, Library **libraries, int *libraries_count)
+{
+    Pattern *patterns = MALLOC(Pattern, n);
+    *count = 0;
+    *libraries_count = 0;
+    *libraries = NULL;
+
+    while (*count < n)
+    {
+        Library l = library_open(BENCH_LIBRARY);
+        LibraryIterator iter;
+        LibraryRecord *rec;
+
+        if (!l)
+        {
+            fprintf(stderr, "can't open %s\n", BENCH_LIBRARY);
+            exit(1);
+        }
+        library_discard_prototypes(l);
+        *libraries = REALLOC(Library, *libraries, *libraries_count + 1);
+        (*libraries)[(*libraries_count)++] = l;
+
+        library_iterator_init(&iter, 1, &l);
+        while (*count < n && (rec = library_iterator_next(&iter)))
+            patterns[(*count)++] = rec->pattern;
+    }
+
+    return patterns;
+}
+
+
+/* What recognize_pattern() does with each candidate. */
+static long scan_patterns(int n, Pattern *patterns, Pattern query)
+{
+    long matches = 0;
+    int i, penalty;
+
+    for (i = 0; i < n; i++)
+    {
+        Match m = match_patterns(patterns[i], query);
+        if (m)
+        {
+            matches += compare_patterns(50, m, patterns[i], query, &penalty) + 1;
+            destroy_match(m);
+        }
+    }
+
+    return matches;
+}
+
+
+static void bench_frozen(void)
+{
+    int n = 50000;
+    int queries = 50;
+    Library *libraries;
+    int libraries_count;
+    Pattern *patterns = load_patterns(n, &n, &libraries, &libraries_count);
+    Pattern *frozen_patterns = MALLOC(Pattern, n);
+    FrozenPatterns frozen;
+    long check1 = 0, check2 = 0;
+    double t, loose, packed;
+    int i;
+
+    for (i = 0; i < n; i++)
+        promote_pattern(patterns[i]);
+    frozen = freeze_patterns(n, patterns);
+    for (i = 0; i < n; i++)
+        frozen_patterns[i] = get_frozen_pattern(frozen, i);
+
+    /* the queries are taken from the last copy, which isn't promoted */
+    {
+        Library l = library_open(BENCH_LIBRARY);
+        LibraryIterator iter;
+        Pattern *q = MALLOC(Pattern, queries);
+        int k = 0;
+
+        library_discard_prototypes(l);
+        library_iterator_init(&iter, 1, &l);
+        for (i = 0; k < queries; i++)
+        {
+            LibraryRecord *rec = library_iterator_next(&iter);
+            if (!rec)
+                break;
+            if (i % 37 == 0)
+                q[k++] = rec->pattern;
+        }
+        queries = k;
+
+        t = seconds();
+        for (i = 0; i < queries; i++)
+            check1 += scan_patterns(n, patterns, q[i]);
+        loose = seconds() - t;
+
+        t = seconds();
+        for (i = 0; i < queries; i++)
+            check2 += scan_patterns(n, frozen_patterns, q[i]);
+        packed = seconds() - t;
+
+        FREE(q);
+        library_free(l);
+    }
+
+    if (check1 != check2)
+    {
+        fprintf(stderr, "frozen patterns match differently\n");
+        exit(1);
+    }
+    sink += check1;
+
+    printf("    %d patterns, %d queries\n", n, queries);
+    report("separate patterns", loose, (long) n * queries);
+    report("frozen patterns", packed, (long) n * queries);
+    printf("    per query: %.2f ms vs %.2f ms\n",
+           loose * 1e3 / queries, packed * 1e3 / queries);
+
+    free_frozen_patterns(frozen);
+    FREE(frozen_patterns);
+    FREE(patterns);
+    for (i = 0; i < libraries_count; i++)
+        library_free(libraries[i]);
+    FREE(libraries);
+}
+
+
+/* ______________________________   batch edit distance   __________________________________ */
+
+
+static void bench_batch(void)
+{
+    int n = 20000;
+    int queries = 50;
+    Library *libraries;
+    int libraries_count;
+    Pattern *patterns = load_patterns(n, &n, &libraries, &libraries_count);
+    Match *matches = MALLOC(Match, n);
+    Pattern *matched = MALLOC(Pattern, n);
+    int *good = MALLOC(int, n);
+    int *penalties = MALLOC(int, n);
+    int *trie_good = MALLOC(int, n);
+    int *trie_penalties = MALLOC(int, n);
+    Library l = library_open(BENCH_LIBRARY);
+    LibraryIterator iter;
+    LibraryRecord *rec;
+    FrozenPatterns frozen;
+    double one_by_one = 0, batched = 0, trie = 0, t;
+    long compared = 0;
+    int i, k = 0;
+
+    for (i = 0; i < n; i++)
+        promote_pattern(patterns[i]);
+    frozen = freeze_patterns(n, patterns);
+    build_frozen_rope_trie(frozen);
+
+    library_discard_prototypes(l);
+    library_iterator_init(&iter, 1, &l);
+    for (i = 0; k < queries && (rec = library_iterator_next(&iter)); i++)
+    {
+        Pattern q = rec->pattern;
+        int count = 0, cutoff = NO_CUTOFF, j;
+
+        if (i % 37)
+            continue;
+        k++;
+
+        for (j = 0; j < n; j++)
+        {
+            Match m = match_patterns(get_frozen_pattern(frozen, j), q);
+            if (m)
+            {
+                matches[count] = m;
+                matched[count] = get_frozen_pattern(frozen, j);
+                count++;
+            }
+        }
+        compared += count;
+
+        t = seconds();
+        compare_patterns_many(50, count, matches, matched, q, good, penalties);
+        batched += seconds() - t;
+
+        /* the cutoff core.c would pass at best */
+        for (j = 0; j < count; j++)
+            if (penalties[j] < cutoff)
+                cutoff = penalties[j];
+
+        t = seconds();
+        compare_frozen_patterns_many(frozen, 50, cutoff, count, matches, matched, q,
+                                     trie_good, trie_penalties);
+        trie += seconds() - t;
+
+        t = seconds();
+        for (j = 0; j < count; j++)
+        {
+            int penalty;
+            int g = compare_patterns(50, matches[j], matched[j], q, &penalty);
+            if (g != good[j] || penalty != penalties[j] || g != trie_good[j]
+             || (penalty <= cutoff ? trie_penalties[j] != penalty
+                                   : trie_penalties[j] <= cutoff))
+            {
+                fprintf(stderr, "batch comparison differs\n");
+                exit(1);
+            }
+        }
+        one_by_one += seconds() - t;
+
+        for (j = 0; j < count; j++)
+            destroy_match(matches[j]);
+    }
+
+    printf("    %d patterns, %d queries, %ld matches\n", n, k, compared);
+    report("compare_patterns", one_by_one, compared);
+    report("compare_patterns_many", batched, compared);
+    report("compare_frozen_patterns_many", trie, compared);
+    printf("    speedup: %.2f (SIMD), %.2f (trie)\n", one_by_one / batched, one_by_one / trie);
+
+    library_free(l);
+    FREE(matches);
+    FREE(matched);
+    FREE(good);
+    FREE(penalties);
+    FREE(trie_good);
+    FREE(trie_penalties);
+    free_frozen_patterns(frozen);
+    FREE(patterns);
+    for (i = 0; i < libraries_count; i++)
+        library_free(libraries[i]);
+    FREE(libraries);
+}
+
+
+/* ______________________________   anti-diagonal edit distance   __________________________________ */
+
+
+static void bench_wavefront(void)
+{
+    static const int lengths[] = {4, 8, 12, 16, 24, 32, 48, 64, 128, 256, 512, 0};
+    int k;
+
+    printf("    %6s %14s %14s\n", "length", "rows, us", "wavefront, us");
+    for (k = 0; lengths[k]; k++)
+    {
+        int length = lengths[k];
+        char *s1 = MALLOC(char, length);
+        char *s2 = MALLOC(char, length);
+        int rounds = 2000000 / (length * length) + 10;
+        long check1 = 0, check2 = 0;
+        double t, rows, wavefront;
+        int i, r;
+
+        srand(length);
+        for (i = 0; i < length; i++)
+        {
+            s1[i] = "2468"[rand() % 4];
+            s2[i] = rand() % 3 ? s1[i] : "2468"[rand() % 4];
+        }
+
+        t = seconds();
+        for (r = 0; r < rounds; r++)
+            check1 += edit_distance_rows(50, s1, length, s2, length);
+        rows = seconds() - t;
+
+        t = seconds();
+        for (r = 0; r < rounds; r++)
+            check2 += edit_distance_wavefront(50, s1, length, s2, length);
+        wavefront = seconds() - t;
+
+        if (check1 != check2)
+        {
+            fprintf(stderr, "anti-diagonal edit distance differs\n");
+            exit(1);
+        }
+        sink += check1;
+
+        printf("    %6d %14.3f %14.3f\n", length, rows * 1e6 / rounds, wavefront * 1e6 / rounds);
+        FREE(s1);
+        FREE(s2);
+    }
+}
+
+
+/* ______________________________   coarse-to-fine fingerprints   __________________________________ */
+
+
+/* The exact nearest neighbor, looking at all the 31 bytes every time. */
+static long nearest_full(int n, Fingerprint *f, Fingerprint q)
+{
+    long best = 0x7FFFFFFFL;
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        long d = fingerprint_distance_squared(f[i], q);
+        if (d < best)
+            best = d;
+    }
+    return best;
+}
+
+
+/* The same, but most fingerprints are dropped after a few bytes. */
+static long nearest_cascaded(int n, Fingerprint *f, Fingerprint q)
+{
+    long best = 0x7FFFFFFFL;
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        long d = fingerprint_distance_squared_bounded(f[i], q, best - 1);
+        if (d < best)
+            best = d;
+    }
+    return best;
+}
+
+
+/* An approximate search: take `k' nearest by the first `levels' levels,
+ * then pick the best of them by the full distance.
+ */
+static long nearest_shortlisted(int n, Fingerprint *f, Fingerprint q,
+                                int levels, int k, long *coarse, int *shortlist)
+{
+    long best = 0x7FFFFFFFL;
+    int count = 0, i, j;
+
+    for (i = 0; i < n; i++)
+    {
+        long d = fingerprint_distance_squared_coarse(f[i], q, levels);
+        if (count == k && d >= coarse[count - 1])
+            continue;
+        if (count < k)
+            count++;
+        for (j = count - 1; j && coarse[j - 1] > d; j--)
+        {
+            coarse[j] = coarse[j - 1];
+            shortlist[j] = shortlist[j - 1];
+        }
+        coarse[j] = d;
+        shortlist[j] = i;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        long d = fingerprint_distance_squared(f[shortlist[i]], q);
+        if (d < best)
+            best = d;
+    }
+    return best;
+}
+
+
+static int compare_fingerprints(const void *a, const void *b)
+{
+    return memcmp(a, b, sizeof(Fingerprint));
+}
+
+
+static void bench_cascade(void)
+{
+    static const int shortlists[] = {1, 4, 16, 64, 0};
+    int n = 20000;
+    int queries = 1000;
+    Library *libraries;
+    int libraries_count;
+    Pattern *patterns = load_patterns(n, &n, &libraries, &libraries_count);
+    Fingerprint *f = MALLOC(Fingerprint, n);
+    Fingerprint *q = MALLOC(Fingerprint, queries);
+    long *exact = MALLOC(long, queries);
+    long *coarse = MALLOC(long, 64);
+    int *shortlist = MALLOC(int, 64);
+    long *distances = MALLOC(long, n);
+    double t, full, cascaded, batch;
+    int i, j, k, levels;
+
+    for (i = 0; i < n; i++)
+        memcpy(f[i], get_pattern_fingerprint(patterns[i]), sizeof(Fingerprint));
+
+    /* the library is loaded several times, but every fingerprint should count once */
+    qsort(f, n, sizeof(Fingerprint), compare_fingerprints);
+    for (i = j = 0; i < n; i++)
+        if (!j || memcmp(f[i], f[j - 1], sizeof(Fingerprint)))
+            memcpy(f[j++], f[i], sizeof(Fingerprint));
+    n = j;
+
+    /* the queries are noisy copies of library fingerprints */
+    srand(3);
+    for (i = 0; i < queries; i++)
+    {
+        unsigned char *src = f[rand() % n];
+        for (j = 0; j < (int) sizeof(Fingerprint); j++)
+        {
+            int v = src[j] + rand() % 25 - 12;
+            q[i][j] = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+    }
+
+    t = seconds();
+    for (i = 0; i < queries; i++)
+        exact[i] = nearest_full(n, f, q[i]);
+    full = seconds() - t;
+
+    t = seconds();
+    for (i = 0; i < queries; i++)
+    {
+        if (nearest_cascaded(n, f, q[i]) != exact[i])
+        {
+            fprintf(stderr, "cascaded search differs\n");
+            exit(1);
+        }
+    }
+    cascaded = seconds() - t;
+
+    t = seconds();
+    for (i = 0; i < queries; i++)
+    {
+        long best = 0x7FFFFFFFL;
+        fingerprint_distances_squared(q[i], f, n, distances);
+        for (j = 0; j < n; j++)
+            if (distances[j] < best)
+                best = distances[j];
+        if (best != exact[i])
+        {
+            fprintf(stderr, "batch search differs\n");
+            exit(1);
+        }
+    }
+    batch = seconds() - t;
+
+    printf("    %d fingerprints, %d queries\n", n, queries);
+    report("full distances", full, (long) n * queries);
+    report("cascaded distances", cascaded, (long) n * queries);
+    report("batch (SIMD) distances", batch, (long) n * queries);
+    printf("    speedup: %.2f (cascade), %.2f (SIMD)\n", full / cascaded, full / batch);
+
+    printf("    %6s %9s %10s %14s\n", "levels", "shortlist", "recall@1", "ns/item");
+    for (levels = 2; levels <= 3; levels++)
+    for (k = 0; shortlists[k]; k++)
+    {
+        int found = 0;
+        t = seconds();
+        for (i = 0; i < queries; i++)
+            if (nearest_shortlisted(n, f, q[i], levels, shortlists[k], coarse, shortlist)
+                == exact[i])
+            {
+                found++;
+            }
+        t = seconds() - t;
+        printf("    %6d %9d %9.1f%% %14.2f\n", levels, shortlists[k],
+               100.0 * found / queries, t * 1e9 / ((long) n * queries));
+    }
+
+    FREE(f);
+    FREE(q);
+    FREE(exact);
+    FREE(coarse);
+    FREE(shortlist);
+    FREE(distances);
+    FREE(patterns);
+    for (i = 0; i < libraries_count; i++)
+        library_free(libraries[i]);
+    FREE(libraries);
+}
+
+
+/* ______________________________   product quantization   __________________________________ */
+
+
+static void bench_pq(void)
+{
+    static const int shortlists[] = {1, 10, 100, 1000, 0};
+    int n = 200000;
+    int queries = 200;
+    int base_count = 20000;
+    Library *libraries;
+    int libraries_count;
+    Pattern *patterns = load_patterns(base_count, &base_count, &libraries, &libraries_count);
+    Fingerprint *f = MALLOC(Fingerprint, n);
+    Fingerprint *q = MALLOC(Fingerprint, queries);
+    long *distances = MALLOC(long, n);
+    long *exact = MALLOC(long, queries);
+    int *candidates = MALLOC(int, 1000);
+    FingerprintIndex x;
+    double t, brute_force, build;
+    int i, j, k;
+
+    /* noisy copies of library fingerprints, to get a library of a large size */
+    srand(7);
+    for (i = 0; i < n + queries; i++)
+    {
+        unsigned char *src = get_pattern_fingerprint(patterns[rand() % base_count]);
+        unsigned char *dst = i < n ? f[i] : q[i - n];
+        for (j = 0; j < (int) sizeof(Fingerprint); j++)
+        {
+            int v = src[j] + rand() % 21 - 10;
+            dst[j] = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+    }
+
+    t = seconds();
+    for (i = 0; i < queries; i++)
+    {
+        fingerprint_distances_squared(q[i], f, n, distances);
+        exact[i] = 0x7FFFFFFFL;
+        for (j = 0; j < n; j++)
+            if (distances[j] < exact[i])
+                exact[i] = distances[j];
+    }
+    brute_force = seconds() - t;
+
+    t = seconds();
+    x = create_fingerprint_index(n, f);
+    build = seconds() - t;
+
+    printf("    %d fingerprints, %d queries, %d bytes per record instead of %d\n",
+           n, queries, PQ_SUBSPACES, (int) sizeof(Fingerprint));
+    printf("    training and encoding: %.3f s\n", build);
+    printf("    brute force (SIMD): %.3f ms per query\n", brute_force * 1e3 / queries);
+    printf("    %9s %10s %14s\n", "shortlist", "recall@k", "ms per query");
+    for (k = 0; shortlists[k]; k++)
+    {
+        int found = 0;
+        t = seconds();
+        for (i = 0; i < queries; i++)
+        {
+            int count = fingerprint_index_search(x, q[i], shortlists[k], candidates);
+            long best = 0x7FFFFFFFL;
+            for (j = 0; j < count; j++)
+            {
+                long d = fingerprint_distance_squared(q[i], f[candidates[j]]);
+                if (d < best)
+                    best = d;
+            }
+            if (best == exact[i])
+                found++;
+        }
+        t = seconds() - t;
+        printf("    %9d %9.1f%% %14.3f\n", shortlists[k],
+               100.0 * found / queries, t * 1e3 / queries);
+    }
+
+    free_fingerprint_index(x);
+    FREE(f);
+    FREE(q);
+    FREE(distances);
+    FREE(exact);
+    FREE(candidates);
+    FREE(patterns);
+    for (i = 0; i < libraries_count; i++)
+        library_free(libraries[i]);
+    FREE(libraries);
+}
+
+
+/* ______________________________   thinning   __________________________________ */
+
+
+/* A glyph-like bitmap: a few strokes of the given width. */
+static unsigned char **strokes(int size, int width)
+{
+    unsigned char **pixels = allocate_bitmap(size, size);
+    int i, x, y;
+
+    clear_bitmap(pixels, size, size);
+    for (i = 0; i < 4; i++)
+    {
+        double x1 = rand() % size, y1 = rand() % size;
+        double x2 = rand() % size, y2 = rand() % size;
+        double dx = x2 - x1, dy = y2 - y1;
+        double length2 = dx * dx + dy * dy + 1e-9;
+
+        for (y = 0; y < size; y++)
+            for (x = 0; x < size; x++)
+            {
+                double t = ((x - x1) * dx + (y - y1) * dy) / length2;
+                double px, py;
+                if (t < 0) t = 0;
+                if (t > 1) t = 1;
+                px = x1 + t * dx - x;
+                py = y1 + t * dy - y;
+                if (4 * (px * px + py * py) <= width * width)
+                    pixels[y][x] = 1;
+            }
+    }
+    return pixels;
+}
+
+
+static const char *thinning_names[] = {"bytes", "packed", "worklist", "rolling"};
+#define THINNING_METHODS ((int) (sizeof(thinning_names) / sizeof(*thinning_names)))
+
+
+static void bench_thinning(void)
+{
+    /* roughly: regular at 300 dpi, bold at 300 dpi, regular and bold at 600 dpi */
+    static const int sizes[] = {32, 48, 96, 96, 0};
+    static const int widths[] = {3, 8, 6, 16, 0};
+    int glyphs = 100;
+    int s, m, i;
+
+    printf("    %6s %6s", "size", "stroke");
+    for (m = 0; m < THINNING_METHODS; m++)
+        printf(" %10s", thinning_names[m]);
+    printf("   (us per glyph)\n");
+
+    for (s = 0; sizes[s]; s++)
+    {
+        int size = sizes[s];
+        unsigned char ***g = MALLOC(unsigned char **, glyphs);
+        unsigned char ***expected = MALLOC(unsigned char **, glyphs);
+        int rounds = 1 + 200000 / (size * size);
+
+        srand(size);
+        for (i = 0; i < glyphs; i++)
+            g[i] = strokes(size, widths[s]);
+
+        printf("    %6d %6d", size, widths[s]);
+        for (m = 0; m < THINNING_METHODS; m++)
+        {
+            double t = seconds();
+            int r;
+            for (r = 0; r < rounds; r++)
+                for (i = 0; i < glyphs; i++)
+                {
+                    unsigned char **result = skeletonize_with_method(g[i], size, size, 0, m);
+                    if (!r && !m)
+                        expected[i] = result;
+                    else
+                    {
+                        if (!r && !bitmaps_equal(result, expected[i], size, size))
+                        {
+                            fprintf(stderr, "%s thinning differs\n", thinning_names[m]);
+                            exit(1);
+                        }
+                        free_bitmap_with_margins(result);
+                    }
+                }
+            t = seconds() - t;
+            printf(" %10.2f", t * 1e6 / ((long) rounds * glyphs));
+        }
+        printf("\n");
+
+        for (i = 0; i < glyphs; i++)
+        {
+            free_bitmap(g[i]);
+            free_bitmap_with_margins(expected[i]);
+        }
+        FREE(g);
+        FREE(expected);
+    }
+}
+
+
+/* ______________________________   main   __________________________________ */
+
+
+typedef struct
+{
+    const char *name;
+    void (*run)(void);
+} Benchmark;
+
+
+static Benchmark benchmarks[] = {
+    {"fingerprints", bench_fingerprints},
+    {"frozen", bench_frozen},
+    {"batch", bench_batch},
+    {"wavefront", bench_wavefront},
+    {"cascade", bench_cascade},
+    {"pq", bench_pq},
+    {"thinning", bench_thinning},
+    {NULL, NULL}
+};
+
+
+int main(int argc, char **argv)
+{
+    int i, j;
+
+    for (i = 0; benchmarks[i].name; i++)
+    {
+        int wanted = argc == 1;
+        for (j = 1; j < argc; j++)
+            if (!strcmp(argv[j], benchmarks[i].name))
+                wanted = 1;
+        if (!wanted)
+            continue;
+        printf("%s:\n", benchmarks[i].name);
+        benchmarks[i].run();
+    }
+
+    return 0;
+}
@@ -399,6 +399,51 @@ int tighten_to_bbox(unsigned char **pixels, int w,
 }
 
 
+int tighten_to_bbox_in_projection(Projection p,
+                                  int *b_x, int *b_y, int *b_w, int *b_h)
+{
+    int i;
+    assert(*b_w > 0 && *b_h > 0);
+
+    for (i = 0; i < *b_h; i++)
+        if (projection_row_sum(p, *b_y + i, *b_x, *b_x + *b_w - 1))
+            break;
+
+    if (i == *b_h)
+    {
+        *b_w = 1;
+        *b_h = 1;
+        return 0;
+    }
+
+    *b_y += i;
+    *b_h -= i;
+
+    for (i = *b_h - 1; i; i--)
+        if (projection_row_sum(p, *b_y + i, *b_x, *b_x + *b_w - 1))
+            break;
+
+    *b_h = i + 1;
+
+    for (i = 0; i < *b_w; i++)
+        if (projection_column_sum(p, *b_x + i, *b_y, *b_y + *b_h - 1))
+            break;
+
+    assert(i != *b_w);
+
+    *b_x += i;
+    *b_w -= i;
+
+    for (i = *b_w - 1; i; i--)
+        if (projection_column_sum(p, *b_x + i, *b_y, *b_y + *b_h - 1))
+            break;
+
+    *b_w = i + 1;
+
+    return 1;
+}
+
+
 int find_bbox(unsigned char **pixels, int w, int h,
               int *b_x, int *b_y, int *b_w, int *b_h)
 {
@@ -442,6 +487,78 @@ int get_bbox_window(unsigned char **pixels, int w, int h,
     return 1;
 }
 
+unsigned char **reduce_bitmap_in_projection(Projection p, int x, int y, int w, int h,
+                                            int factor)
+{
+    int r_w = (w + factor - 1) / factor;
+    int r_h = (h + factor - 1) / factor;
+    unsigned char **result = allocate_bitmap(r_w, r_h);
+    int i, j;
+
+    for (i = 0; i < r_h; i++)
+    {
+        int top = i * factor;
+        int block_h = top + factor <= h ? factor : h - top;
+        for (j = 0; j < r_w; j++)
+        {
+            int left = j * factor;
+            int block_w = left + factor <= w ? factor : w - left;
+            int mass = projection_sum(p, x + left, y + top, block_w, block_h);
+            result[i][j] = (unsigned char) (mass * 2 >= block_w * block_h);
+        }
+    }
+
+    return result;
+}
+
+
+static int black_in_page(unsigned char **pixels, int page_w, int page_h, int x, int y)
+{
+    return x >= 0 && y >= 0 && x < page_w && y < page_h && pixels[y][x];
+}
+
+
+/* A black pixel of the ring around the window touching a black pixel inside? */
+static int ring_pixel_touches(unsigned char **pixels, int page_w, int page_h,
+                              int x, int y, int w, int h, int rx, int ry)
+{
+    int i, j;
+
+    if (!black_in_page(pixels, page_w, page_h, rx, ry))
+        return 0;
+
+    for (i = ry - 1; i <= ry + 1; i++)
+        for (j = rx - 1; j <= rx + 1; j++)
+            if (j >= x && i >= y && j < x + w && i < y + h && pixels[i][j])
+                return 1;
+
+    return 0;
+}
+
+
+int window_is_isolated(unsigned char **pixels, int page_w, int page_h,
+                       int x, int y, int w, int h)
+{
+    int i;
+
+    for (i = x - 1; i <= x + w; i++)
+    {
+        if (ring_pixel_touches(pixels, page_w, page_h, x, y, w, h, i, y - 1)
+         || ring_pixel_touches(pixels, page_w, page_h, x, y, w, h, i, y + h))
+            return 0;
+    }
+
+    for (i = y; i < y + h; i++)
+    {
+        if (ring_pixel_touches(pixels, page_w, page_h, x, y, w, h, x - 1, i)
+         || ring_pixel_touches(pixels, page_w, page_h, x, y, w, h, x + w, i))
+            return 0;
+    }
+
+    return 1;
+}
+
+
 #ifdef TESTING
 
 /* Try writing into the pointer array and the bitmap.
@@ -489,8 +606,46 @@ static void allocate_bitmap_basic_test(void)
 }
 
 
+static void window_is_isolated_test(void)
+{
+    unsigned char **page = allocate_bitmap(5, 5);
+
+    clear_bitmap(page, 5, 5);
+    page[1][1] = page[2][2] = 1;
+    assert(window_is_isolated(page, 5, 5, 1, 1, 2, 2));
+    assert(window_is_isolated(page, 5, 5, 0, 0, 5, 5));
+    assert(!window_is_isolated(page, 5, 5, 1, 1, 1, 1)); /* diagonal touch */
+    page[4][4] = 1;
+    assert(window_is_isolated(page, 5, 5, 1, 1, 2, 2));
+    assert(!window_is_isolated(page, 5, 5, 2, 2, 3, 3));
+    free_bitmap(page);
+}
+
+
+static void reduce_bitmap_test(void)
+{
+    unsigned char **pixels = allocate_bitmap(5, 4);
+    unsigned char **reduced;
+    Projection p;
+
+    clear_bitmap(pixels, 5, 4);
+    pixels[0][0] = pixels[1][1] = 1;    /* half of the block */
+    pixels[2][2] = 1;                   /* a quarter */
+    pixels[0][4] = 1;                   /* half of a cut block */
+    p = create_projection_bw(pixels, 0, 0, 5, 4);
+    reduced = reduce_bitmap_in_projection(p, 0, 0, 5, 4, 2);
+    assert(reduced[0][0] == 1 && reduced[0][1] == 0 && reduced[0][2] == 1);
+    assert(reduced[1][0] == 0 && reduced[1][1] == 0 && reduced[1][2] == 0);
+    free_bitmap(reduced);
+    free_projection(p);
+    free_bitmap(pixels);
+}
+
+
 static TestFunction tests[] = {
     allocate_bitmap_basic_test,
+    reduce_bitmap_test,
+    window_is_isolated_test,
     NULL
 };
 
@@ -25,6 +25,7 @@
 
 
 #include "common.h"
+#include "projection.h"
 
 FUNCTIONS_BEGIN
 
@@ -86,6 +87,21 @@ void find_mass_center(unsigned char **pixels, int w, int h, int *m, int *cx, int
 int tighten_to_bbox(unsigned char **pixels, int w,
                     int *b_x, int *b_y, int *b_w, int *b_h);
 
+/* The same, but the rectangle is in a black-and-white projection
+ * and every row and column is checked in O(1).
+ */
+int tighten_to_bbox_in_projection(Projection,
+                                  int *b_x, int *b_y, int *b_w, int *b_h);
+
+/* Shrink the w * h window at (x, y) of a black-and-white projection
+ * `factor' times in both directions. A pixel of the result is black
+ * if at least half of its block is black (the blocks at the right
+ * and at the bottom may be cut), so the area is about the same.
+ * The result is (w / factor) * (h / factor), rounded up, and it's 0/1.
+ */
+unsigned char **reduce_bitmap_in_projection(Projection, int x, int y, int w, int h,
+                                            int factor);
+
 /* Find a bounding box. Returns nonzero if the image is non-empty.
  */
 int find_bbox(unsigned char **pixels, int w, int h,
@@ -100,6 +116,13 @@ int get_bbox_window(unsigned char **pixels, int w, int h,
 
 unsigned char **subbitmap(unsigned char **pixels, int x, int y, int h);
 
+/* Returns true if no black pixel in the w * h window at (x, y) of the page
+ * touches (even diagonally) a black pixel outside of it.
+ * Then whatever is in the window can be thinned along with the whole page.
+ */
+int window_is_isolated(unsigned char **pixels, int page_w, int page_h,
+                       int x, int y, int w, int h);
+
 unsigned char **simple_noise(int w, int h);
 
 FUNCTIONS_END
@@ -0,0 +1,384 @@
+/* Plasma OCR - an OCR engine
+ *
+ * cache.c - a cache of recognition results keyed by exact bitmaps
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "common.h"
+#include "cache.h"
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+
+typedef struct EntryStruct Entry;
+
+struct EntryStruct
+{
+    unsigned long hash;
+    int kind, width, height;
+    unsigned char *pixels;      /* width * height, row by row */
+    CachedResult result;
+
+    Entry *next_in_bucket;
+    Entry *newer, *older;       /* the LRU list */
+};
+
+
+struct ResultCacheStruct
+{
+    int capacity, count;
+    int buckets_count;          /* a power of 2 */
+    Entry **buckets;
+    Entry *newest, *oldest;
+    long hits, misses;
+    pthread_mutex_t mutex;
+};
+
+
+/* ______________________________   results   __________________________________ */
+
+
+static char *copy_text(const char *text)
+{
+    char *result;
+    if (!text)
+        return NULL;
+    result = MALLOC(char, strlen(text) + 1);
+    strcpy(result, text);
+    return result;
+}
+
+
+static void copy_result(CachedResult *dst, CachedResult *src)
+{
+    int i;
+    dst->count = src->count;
+    dst->colors = MALLOC(ColorCode, src->count + 1);
+    dst->texts = MALLOC(char *, src->count + 1);
+    for (i = 0; i < src->count; i++)
+    {
+        dst->colors[i] = src->colors[i];
+        dst->texts[i] = copy_text(src->texts[i]);
+    }
+}
+
+
+static void destroy_result(CachedResult *r)
+{
+    int i;
+    for (i = 0; i < r->count; i++)
+        if (r->texts[i])
+            FREE(r->texts[i]);
+    FREE(r->texts);
+    FREE(r->colors);
+}
+
+
+void free_cached_result(CachedResult *r)
+{
+    destroy_result(r);
+    FREE1(r);
+}
+
+
+/* ______________________________   the cache   __________________________________ */
+
+
+ResultCache create_result_cache(int capacity)
+{
+    ResultCache c = MALLOC1(struct ResultCacheStruct);
+    int i;
+
+    assert(capacity >= 0);
+    c->capacity = capacity;
+    c->count = 0;
+    c->buckets_count = 1;
+    while (c->buckets_count < capacity)
+        c->buckets_count <<= 1;
+    c->buckets = MALLOC(Entry *, c->buckets_count);
+    for (i = 0; i < c->buckets_count; i++)
+        c->buckets[i] = NULL;
+    c->newest = c->oldest = NULL;
+    c->hits = c->misses = 0;
+    pthread_mutex_init(&c->mutex, NULL);
+    return c;
+}
+
+
+static void destroy_entry(Entry *e)
+{
+    destroy_result(&e->result);
+    FREE(e->pixels);
+    FREE1(e);
+}
+
+
+static void clear(ResultCache c)
+{
+    Entry *e = c->newest;
+    int i;
+
+    while (e)
+    {
+        Entry *older = e->older;
+        destroy_entry(e);
+        e = older;
+    }
+    for (i = 0; i < c->buckets_count; i++)
+        c->buckets[i] = NULL;
+    c->newest = c->oldest = NULL;
+    c->count = 0;
+}
+
+
+void free_result_cache(ResultCache c)
+{
+    clear(c);
+    pthread_mutex_destroy(&c->mutex);
+    FREE(c->buckets);
+    FREE1(c);
+}
+
+
+void clear_result_cache(ResultCache c)
+{
+    pthread_mutex_lock(&c->mutex);
+    clear(c);
+    pthread_mutex_unlock(&c->mutex);
+}
+
+
+void get_result_cache_stats(ResultCache c, long *hits, long *misses)
+{
+    pthread_mutex_lock(&c->mutex);
+    if (hits) *hits = c->hits;
+    if (misses) *misses = c->misses;
+    pthread_mutex_unlock(&c->mutex);
+}
+
+
+/* FNV-1a over the kind, the size and the window. */
+static unsigned long hash_window(int kind, unsigned char **pixels,
+                                 int x, int y, int w, int h)
+{
+    unsigned long hash = 2166136261UL;
+    int i, j;
+
+#define HASH_BYTE(B) hash = ((hash ^ (unsigned char) (B)) * 16777619UL) & 0xFFFFFFFFUL
+    HASH_BYTE(kind);
+    HASH_BYTE(w); HASH_BYTE(w >> 8);
+    HASH_BYTE(h); HASH_BYTE(h >> 8);
+    for (i = 0; i < h; i++)
+    {
+        unsigned char *row = pixels[y + i] + x;
+        for (j = 0; j < w; j++)
+            HASH_BYTE(row[j]);
+    }
+#undef HASH_BYTE
+
+    return hash;
+}
+
+
+static int entry_matches(Entry *e, unsigned long hash, int kind,
+                         unsigned char **pixels, int x, int y, int w, int h)
+{
+    int i;
+
+    if (e->hash != hash || e->kind != kind || e->width != w || e->height != h)
+        return 0;
+    for (i = 0; i < h; i++)
+        if (memcmp(e->pixels + i * w, pixels[y + i] + x, w))
+            return 0;
+    return 1;
+}
+
+
+static Entry *find(ResultCache c, unsigned long hash, int kind,
+                   unsigned char **pixels, int x, int y, int w, int h)
+{
+    Entry *e = c->buckets[hash & (c->buckets_count - 1)];
+    while (e && !entry_matches(e, hash, kind, pixels, x, y, w, h))
+        e = e->next_in_bucket;
+    return e;
+}
+
+
+static void unlink_lru(ResultCache c, Entry *e)
+{
+    if (e->newer) e->newer->older = e->older; else c->newest = e->older;
+    if (e->older) e->older->newer = e->newer; else c->oldest = e->newer;
+}
+
+
+static void link_lru(ResultCache c, Entry *e)
+{
+    e->newer = NULL;
+    e->older = c->newest;
+    if (c->newest) c->newest->newer = e; else c->oldest = e;
+    c->newest = e;
+}
+
+
+static void evict_oldest(ResultCache c)
+{
+    Entry *e = c->oldest;
+    Entry **p = &c->buckets[e->hash & (c->buckets_count - 1)];
+
+    while (*p != e)
+        p = &(*p)->next_in_bucket;
+    *p = e->next_in_bucket;
+
+    unlink_lru(c, e);
+    destroy_entry(e);
+    c->count--;
+}
+
+
+CachedResult *result_cache_lookup(ResultCache c, int kind,
+                                  unsigned char **pixels, int x, int y, int w, int h)
+{
+    unsigned long hash = hash_window(kind, pixels, x, y, w, h);
+    CachedResult *result = NULL;
+    Entry *e;
+
+    pthread_mutex_lock(&c->mutex);
+    e = find(c, hash, kind, pixels, x, y, w, h);
+    if (e)
+    {
+        unlink_lru(c, e);
+        link_lru(c, e);
+        result = MALLOC1(CachedResult);
+        copy_result(result, &e->result);
+        c->hits++;
+    }
+    else
+        c->misses++;
+    pthread_mutex_unlock(&c->mutex);
+
+    return result;
+}
+
+
+void result_cache_store(ResultCache c, int kind,
+                        unsigned char **pixels, int x, int y, int w, int h,
+                        CachedResult *r)
+{
+    unsigned long hash;
+    Entry *e;
+    int i;
+
+    if (!c->capacity)
+        return;
+
+    hash = hash_window(kind, pixels, x, y, w, h);
+    pthread_mutex_lock(&c->mutex);
+
+    /* another thread might have stored it meanwhile */
+    if (!find(c, hash, kind, pixels, x, y, w, h))
+    {
+        Entry **bucket = &c->buckets[hash & (c->buckets_count - 1)];
+
+        if (c->count == c->capacity)
+            evict_oldest(c);
+
+        e = MALLOC1(Entry);
+        e->hash = hash;
+        e->kind = kind;
+        e->width = w;
+        e->height = h;
+        e->pixels = MALLOC(unsigned char, w * h);
+        for (i = 0; i < h; i++)
+            memcpy(e->pixels + i * w, pixels[y + i] + x, w);
+        copy_result(&e->result, r);
+
+        e->next_in_bucket = *bucket;
+        *bucket = e;
+        link_lru(c, e);
+        c->count++;
+    }
+
+    pthread_mutex_unlock(&c->mutex);
+}
+
+
+/* ______________________________   testing   __________________________________ */
+
+#ifdef TESTING
+
+static void store_letter(ResultCache c, unsigned char **pixels, char *text)
+{
+    ColorCode color = CC_GREEN;
+    CachedResult r;
+    r.count = 1;
+    r.colors = &color;
+    r.texts = &text;
+    result_cache_store(c, 0, pixels, 0, 0, 2, 2, &r);
+}
+
+static int lookup_letter(ResultCache c, unsigned char **pixels, const char *text)
+{
+    CachedResult *r = result_cache_lookup(c, 0, pixels, 0, 0, 2, 2);
+    int ok;
+    if (!r)
+        return 0;
+    ok = r->count == 1 && r->colors[0] == CC_GREEN && !strcmp(r->texts[0], text);
+    free_cached_result(r);
+    return ok;
+}
+
+static void test_eviction(void)
+{
+    unsigned char a[2][2] = {{1, 0}, {0, 1}};
+    unsigned char b[2][2] = {{0, 1}, {1, 0}};
+    unsigned char d[2][2] = {{1, 1}, {1, 1}};
+    unsigned char *pa[2], *pb[2], *pd[2];
+    ResultCache c = create_result_cache(2);
+    long hits, misses;
+
+    pa[0] = a[0]; pa[1] = a[1];
+    pb[0] = b[0]; pb[1] = b[1];
+    pd[0] = d[0]; pd[1] = d[1];
+
+    store_letter(c, pa, "a");
+    store_letter(c, pb, "b");
+    assert(lookup_letter(c, pa, "a"));  /* now `b' is the oldest */
+    store_letter(c, pd, "d");
+    assert(!lookup_letter(c, pb, "b"));
+    assert(lookup_letter(c, pa, "a"));
+    assert(lookup_letter(c, pd, "d"));
+    assert(!result_cache_lookup(c, 1, pa, 0, 0, 2, 2)); /* another kind */
+
+    clear_result_cache(c);
+    assert(!lookup_letter(c, pa, "a"));
+
+    get_result_cache_stats(c, &hits, &misses);
+    assert(hits == 3 && misses == 3);
+    free_result_cache(c);
+}
+
+static TestFunction tests[] = {
+    test_eviction,
+    NULL
+};
+
+TestSuite cache_suite = {"cache", NULL, NULL, tests};
+
+#endif
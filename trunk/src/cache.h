@@ -0,0 +1,80 @@
+/* Plasma OCR - an OCR engine
+ *
+ * cache.h - a cache of recognition results keyed by exact bitmaps
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/* The same glyph bitmap appears on a page again and again,
+ * and recognition is a pure function of the bitmap (given the libraries).
+ * So we remember the answers. The cache holds a bounded number of entries
+ * and evicts the least recently used one. It is safe to share between threads.
+ */
+
+
+#ifndef PLASMA_OCR_CACHE_H
+#define PLASMA_OCR_CACHE_H
+
+
+#include "core.h"
+
+
+typedef struct ResultCacheStruct *ResultCache;
+
+
+/* What's remembered: colors and texts of the letters (a single one or a word).
+ */
+typedef struct
+{
+    int count;
+    ColorCode *colors;
+    char **texts;           /* NULL for no text */
+} CachedResult;
+
+void free_cached_result(CachedResult *);
+
+
+/* A cache of `capacity' entries; 0 makes a cache that never hits.
+ */
+ResultCache create_result_cache(int capacity);
+void free_result_cache(ResultCache);
+
+/* Forget everything (but keep the counters). */
+void clear_result_cache(ResultCache);
+
+/* The key is the kind of the request (e.g. letter or word)
+ * and the w * h window at (x, y) of `pixels'.
+ * Returns a fresh copy of the result or NULL on a miss.
+ */
+CachedResult *result_cache_lookup(ResultCache, int kind,
+                                  unsigned char **pixels, int x, int y, int w, int h);
+
+/* Remember the result (it's copied). */
+void result_cache_store(ResultCache, int kind,
+                        unsigned char **pixels, int x, int y, int w, int h,
+                        CachedResult *);
+
+void get_result_cache_stats(ResultCache, long *hits, long *misses);
+
+
+#ifdef TESTING
+extern TestSuite cache_suite;
+#endif
+
+
+#endif
@@ -2,6 +2,7 @@
 #include "bitmaps.h"
 #include "thinning.h"
 #include "io.h"
+#include "stats.h"
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
@@ -25,15 +26,23 @@ Chaincode *chaincode_create(int w, int h)
     cc->rope_allocated = 10;
     cc->nodes = MALLOC(Node, cc->node_allocated);
     cc->ropes = MALLOC(Rope, cc->rope_allocated);
+    cc->arena = NULL;
     return cc;
 }
 
 
+/* An arena can't be grown: the lists are in the middle of it. */
 Rope *chaincode_append_rope(Chaincode *cc)
+{
+    assert(!cc->arena);
     LIST_APPEND(Rope, cc->ropes, cc->rope_count, cc->rope_allocated)
+}
 
 Node *chaincode_append_node(Chaincode *cc)
+{
+    assert(!cc->arena);
     LIST_APPEND(Node, cc->nodes, cc->node_count, cc->node_allocated)
+}
 
 
 /* The marking system is tricky. The byte is used to the full :)
@@ -102,16 +111,44 @@ static char *append_step(char **steps, int *count, int *allocated)
     LIST_APPEND(char, *steps, *count, *allocated)
 
 
-static int find_node(Chaincode *cc, int x, int y)
+/* A chaincode is extracted into a single block of memory, the arena:
+ *
+ *     nodes | ropes | rope indices of nodes | node map | steps of ropes
+ *
+ * The sizes are bounded by the number of black pixels, B, before the extraction.
+ * Let N be the number of hot points, D the sum of their degrees (D <= 4N)
+ * and C the number of cycles. Nodes are black pixels, so N + C <= B.
+ * Then there are D / 2 + C <= 2B ropes and D + 2C <= 4B rope indices.
+ * Every black pixel that's not a node is entered once and a node once per rope,
+ * so there are B - (N + C) + (D / 2 + C) <= 2B steps.
+ * The node map is an int per pixel of the framework, giving the index of a node
+ * by its coordinates; it's only written and read where the nodes are.
+ */
+typedef struct
 {
-    int i;
-    for (i = 0; i < cc->node_count; i++)
+    Chaincode *cc;
+    int *free_indices;      /* rope indices of the nodes to come */
+    char *free_steps;       /* steps of the ropes to come */
+    int *node_map;
+    int w;
+} Extraction;
+
+
+static void new_node(Extraction *e, int x, int y, int degree)
+{
+    Chaincode *cc = e->cc;
+    Node *n = &cc->nodes[cc->node_count];
+    e->node_map[y * e->w + x] = cc->node_count++;
+    n->x = x;
+    n->y = y;
+    n->degree = degree;
+    if (degree)
     {
-        if (cc->nodes[i].x == x  &&  cc->nodes[i].y == y)
-            return i;
+        n->rope_indices = e->free_indices;
+        e->free_indices += degree;
     }
-    assert(0);
-    return -1;
+    else
+        n->rope_indices = NULL;
 }
 
 
@@ -146,13 +183,12 @@ static void determine_direction_first_time(unsigned char **pixels, int x, int y,
  * and travels until the first hot point.
  */
     
-static void walk(Chaincode *cc, int start_node, unsigned char **pixels, int dx, int dy)
+static void walk(Extraction *e, int start_node, unsigned char **pixels, int dx, int dy)
 {
+    Chaincode *cc = e->cc;
     int x, y;
-    int allocated = 20;
-    int count = 0;
+    char *steps = e->free_steps;
     Rope *rope;
-    char *steps;
     
     assert(0 <= start_node  &&  start_node < cc->node_count);
     
@@ -169,12 +205,11 @@ static void walk(Chaincode *cc, int start_node, unsigned char **pixels, int dx,
 
     cc->nodes[start_node].rope_indices[count_passed_edges(pixels[y][x])] = cc->rope_count;
 
-    steps = MALLOC(char, allocated);
     mark_edge(pixels, x, y, dx, dy);
 
     x += dx;
     y += dy;
-    *append_step(&steps, &count, &allocated) = chaincode_char(dx, dy);
+    *e->free_steps++ = chaincode_char(dx, dy);
     if (pixels[y][x] == 1)
     {
         pixels[y][x] = 0;
@@ -184,7 +219,7 @@ static void walk(Chaincode *cc, int start_node, unsigned char **pixels, int dx,
         {
             x += dx;
             y += dy;
-            *append_step(&steps, &count, &allocated) = chaincode_char(dx, dy);
+            *e->free_steps++ = chaincode_char(dx, dy);
             if (pixels[y][x] != 1)  break;
             pixels[y][x] = 0;
 
@@ -197,21 +232,36 @@ static void walk(Chaincode *cc, int start_node, unsigned char **pixels, int dx,
     mark_edge(pixels, x, y, -dx, -dy);
     
     /* Add the rope. */
-    rope = chaincode_append_rope(cc);
+    rope = &cc->ropes[cc->rope_count++];
     rope->start = start_node;
-    rope->end = find_node(cc, x, y);
-    rope->steps = REALLOC(char, steps, count);
-    rope->length = count;
+    rope->end = e->node_map[y * e->w + x];
+    rope->steps = steps;
+    rope->length = e->free_steps - steps;
     cc->nodes[rope->end].rope_indices[count_passed_edges(pixels[y][x]) - 1] = cc->rope_count - 1;
 }
 
 
+/* The framework is 0/1 at this point. */
+static int count_black_pixels(unsigned char **pixels, int w, int h)
+{
+    int x, y, black = 0;
+
+    for (y = 0; y < h; y++)
+    {
+        unsigned char *row = pixels[y];
+        for (x = 0; x < w; x++)
+            black += row[x];
+    }
+    return black;
+}
+
+
 /* Search for hot points (with degree != 2).
  * Makes them nodes of the chaincode.
  * Does not mark them in-place, it would be done afterwards
  * (it could interfere with degree counting).
  */
-static void search_hot_points(Chaincode *cc, unsigned char **pixels, int w, int h)
+static void search_hot_points(Extraction *e, unsigned char **pixels, int w, int h)
 {
     int x, y;
 
@@ -223,16 +273,7 @@ static void search_hot_points(Chaincode *cc, unsigned char **pixels, int w, int
         {
             int degree = row[x - 1] + row[x + 1] + pixels[y - 1][x] + pixels[y + 1][x];
             if (degree != 2)
-            {
-                Node *n = chaincode_append_node(cc);
-                n->x = x;
-                n->y = y;
-                n->degree = degree;
-                if (degree)
-                    n->rope_indices = MALLOC(int, degree);
-                else
-                    n->rope_indices = NULL;
-            }
+                new_node(e, x, y, degree);
         }
     }
 }
@@ -256,22 +297,14 @@ static void mark_hot_points(Chaincode *cc, unsigned char **pixels, int w, int h)
  *  There should be such a point in each cycle,
  *  for example, the leftmost of its topmost points.
  */
-static void take_cycle(Chaincode *cc, unsigned char **pixels, int x, int y)
+static void take_cycle(Extraction *e, unsigned char **pixels, int x, int y)
 {
-    Node *n;
-
     assert(pixels[y + 1][x]);
     assert(pixels[y][x + 1]);
 
     pixels[y][x] = HOT_POINT;
-    
-    n = chaincode_append_node(cc);
-    n->x = x;
-    n->y = y;
-    n->degree = 2;
-    n->rope_indices = MALLOC(int, 2);
-    
-    walk(cc, cc->node_count - 1,  pixels, 0,  1);
+    new_node(e, x, y, 2);
+    walk(e, e->cc->node_count - 1,  pixels, 0,  1);
 
     /* We should return to the starting point from the left. */
     assert(passed_edge(pixels[y][x], 1, 0));
@@ -280,7 +313,7 @@ static void take_cycle(Chaincode *cc, unsigned char **pixels, int x, int y)
 /* By this point, there should be only cycles and hot points remaining.
  * We inject a fake node into each cycle and take them.
  */
-static void take_all_cycles(Chaincode *cc, unsigned char **pixels, int w, int h)
+static void take_all_cycles(Extraction *e, unsigned char **pixels, int w, int h)
 {
     int x, y;
     for (y = 0; y < h; y++)
@@ -297,7 +330,7 @@ static void take_all_cycles(Chaincode *cc, unsigned char **pixels, int w, int h)
              */
             if (!row[x - 1] && !upper[x])
             {
-                take_cycle(cc, pixels, x, y);
+                take_cycle(e, pixels, x, y);
             }
         }   
     }
@@ -307,24 +340,45 @@ static void take_all_cycles(Chaincode *cc, unsigned char **pixels, int w, int h)
 Chaincode *chaincode_compute_internal(unsigned char **framework, int w, int h)
 {
     int i;
-    Chaincode *cc = chaincode_create(w, h);
-    search_hot_points(cc, framework, w, h);
+    int black = count_black_pixels(framework, w, h);
+    size_t ropes_at = black * sizeof(Node);
+    size_t indices_at = ropes_at + 2 * black * sizeof(Rope);
+    size_t map_at = indices_at + 4 * black * sizeof(int);
+    size_t steps_at = map_at + w * h * sizeof(int);
+    Chaincode *cc = MALLOC1(Chaincode);
+    Extraction e;
+
+    cc->arena = MALLOC(char, steps_at + 2 * black);
+    cc->width = w;
+    cc->height = h;
+    cc->nodes = (Node *) cc->arena;
+    cc->ropes = (Rope *) (cc->arena + ropes_at);
+    cc->node_count = cc->rope_count = 0;
+
+    e.cc = cc;
+    e.free_indices = (int *) (cc->arena + indices_at);
+    e.node_map = (int *) (cc->arena + map_at);
+    e.free_steps = cc->arena + steps_at;
+    e.w = w;
+
+    search_hot_points(&e, framework, w, h);
     mark_hot_points(cc, framework, w, h);
     
     for (i = 0; i < cc->node_count; i++)
     {
-        walk(cc, i, framework,  0, -1);
-        walk(cc, i, framework,  0,  1);
-        walk(cc, i, framework, -1,  0);
-        walk(cc, i, framework,  1,  0);
+        walk(&e, i, framework,  0, -1);
+        walk(&e, i, framework,  0,  1);
+        walk(&e, i, framework, -1,  0);
+        walk(&e, i, framework,  1,  0);
     }
 
-    take_all_cycles(cc, framework, w, h);
+    take_all_cycles(&e, framework, w, h);
 
+    assert(cc->node_count <= black && cc->rope_count <= 2 * black);
+    assert(e.free_indices <= (int *) (cc->arena + map_at));
+    assert(e.free_steps <= cc->arena + steps_at + 2 * black);
     cc->node_allocated = cc->node_count;
-    cc->nodes = REALLOC(Node, cc->nodes, cc->node_allocated);
     cc->rope_allocated = cc->rope_count;
-    cc->ropes = REALLOC(Rope, cc->ropes, cc->rope_allocated);
     
     return cc;
 }
@@ -338,6 +392,13 @@ void chaincode_destroy(Chaincode *cc)
     int rope_count = cc->rope_count;
     int node_count = cc->node_count;
     int i;
+
+    if (cc->arena)
+    {
+        FREE(cc->arena);
+        FREE1(cc);
+        return;
+    }
     
     for (i = 0; i < rope_count; i++)
         if (ropes[i].steps)
@@ -444,6 +505,7 @@ Chaincode *chaincode_scale(Chaincode *cc, float coef)
     result->rope_count = result->rope_allocated = cc->rope_count;
     result->nodes = MALLOC(Node, result->node_allocated);
     result->ropes = MALLOC(Rope, result->rope_allocated);
+    result->arena = NULL;
     assert(coef > 0);
     assert(coef < 1e5);
     
@@ -497,8 +559,12 @@ void chaincode_get_rope_middle_point(Chaincode *cc, int rope_index, float *px, f
 
 Chaincode *chaincode_compute(unsigned char **pixels, int w, int h)
 {
-    unsigned char **framework = skeletonize(pixels, w, h, /* 8-conn.: */ 0);
-    Chaincode *result = chaincode_compute_internal(framework, w, h);
+    unsigned char **framework;
+    Chaincode *result;
+    STATS_TIME(STAT_SKELETONIZE,
+               framework = skeletonize(pixels, w, h, /* 8-conn.: */ 0));
+    STATS_TIME(STAT_CHAINCODE,
+               result = chaincode_compute_internal(framework, w, h));
     free_bitmap_with_margins(framework);
     return result;
 }
@@ -575,6 +641,7 @@ Chaincode *chaincode_load(FILE *f)
     cc->rope_count = cc->rope_allocated = r;
     cc->nodes = MALLOC(Node, n);
     cc->ropes = MALLOC(Rope, r);
+    cc->arena = NULL;
 
     fread(&cc->width, 1, sizeof(cc->width), f);
     fread(&cc->height, 1, sizeof(cc->height), f);
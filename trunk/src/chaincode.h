@@ -38,13 +38,14 @@ typedef struct
     float height;
     int node_allocated;  /* in fact, these two fields should be hidden */
     int rope_allocated;
+    char *arena;         /* NULL, or the block where all of the above lives */
 } Chaincode;
 
 
 FUNCTIONS_BEGIN
 
 /* Append a new node/rope to the end.
- * Doesn't initialize them.
+ * Doesn't initialize them. Not for chaincodes with an arena.
  */
 Rope *chaincode_append_rope(Chaincode *);
 Node *chaincode_append_node(Chaincode *);
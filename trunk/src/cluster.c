@@ -0,0 +1,234 @@
+/* Plasma OCR - an OCR engine
+ *
+ * cluster.c - grouping near-identical glyph images
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "common.h"
+#include "cluster.h"
+#include "bitmaps.h"
+#include "shiftcut.h"
+#include <assert.h>
+#include <string.h>
+
+
+#define TABLE_SIZE 4096     /* a power of 2 */
+
+
+typedef struct
+{
+    int representative;
+    int kind, width, height;    /* of the bounding box */
+    Fingerprint fingerprint;
+    unsigned char *bits;        /* threshold 0 only: the pixels of the box, 0/1 row by row */
+    int next;                   /* next cluster in the chain, or -1 */
+} Cluster;
+
+
+struct GlyphClustersStruct
+{
+    long threshold;
+    int count, allocated;
+    Cluster *clusters;
+    int table[TABLE_SIZE];      /* heads of the chains, -1 for empty */
+};
+
+
+static Cluster *append_cluster(GlyphClusters g)
+    LIST_APPEND(Cluster, g->clusters, g->count, g->allocated)
+
+
+GlyphClusters create_glyph_clusters(long threshold)
+{
+    GlyphClusters g = MALLOC1(struct GlyphClustersStruct);
+    int i;
+
+    g->threshold = threshold;
+    LIST_CREATE(Cluster, g->clusters, g->count, g->allocated, 64);
+    for (i = 0; i < TABLE_SIZE; i++)
+        g->table[i] = -1;
+    return g;
+}
+
+
+void free_glyph_clusters(GlyphClusters g)
+{
+    int i;
+    for (i = 0; i < g->count; i++)
+        if (g->clusters[i].bits)
+            FREE(g->clusters[i].bits);
+    FREE(g->clusters);
+    FREE1(g);
+}
+
+
+static int hash_size(int kind, int w, int h)
+{
+    return (kind * 7919 + w * 131 + h) & (TABLE_SIZE - 1);
+}
+
+
+/* The pixels of the box as 0/1, row by row. */
+static unsigned char *get_box_bits(unsigned char **pixels, int x, int y, int w, int h)
+{
+    unsigned char *bits = MALLOC(unsigned char, w * h + 1);
+    int i, j;
+
+    for (i = 0; i < h; i++)
+        for (j = 0; j < w; j++)
+            bits[i * w + j] = pixels[y + i][x + j] ? 1 : 0;
+    return bits;
+}
+
+
+int cluster_glyph(GlyphClusters g, int id, int kind,
+                  unsigned char **pixels, int width, int height)
+{
+    int x, y, w, h, i;
+    Fingerprint f;
+    int best = -1;
+    long best_distance = 0;
+    int chain;
+    Cluster *c;
+    unsigned char *bits = NULL;
+    Projection p = create_projection_bw(pixels, 0, 0, width, height);
+
+    x = y = 0;
+    w = width;
+    h = height;
+    if (tighten_to_bbox_in_projection(p, &x, &y, &w, &h))
+        get_fingerprint_in_projection(p, x, y, w, h, &f);
+    else
+    {
+        w = h = 0;
+        for (i = 0; i < (int) sizeof(Fingerprint); i++)
+            f[i] = 0;
+    }
+    free_projection(p);
+
+    /* Equal fingerprints don't make equal glyphs, so threshold 0 compares the pixels. */
+    if (!g->threshold)
+        bits = get_box_bits(pixels, x, y, w, h);
+
+    chain = hash_size(kind, w, h);
+    for (i = g->table[chain]; i != -1; i = g->clusters[i].next)
+    {
+        long d;
+        c = &g->clusters[i];
+        if (c->kind != kind || c->width != w || c->height != h)
+            continue;
+        d = fingerprint_distance_squared_bounded(c->fingerprint, f,
+                best != -1 && best_distance < g->threshold ? best_distance : g->threshold);
+        if (bits && (d || memcmp(c->bits, bits, w * h)))
+            continue;
+        if (d <= g->threshold && (best == -1 || d <= best_distance))
+        {
+            /* the chain goes from newer to older clusters, so `<=' prefers older */
+            best = i;
+            best_distance = d;
+        }
+    }
+
+    if (best != -1)
+    {
+        if (bits)
+            FREE(bits);
+        return g->clusters[best].representative;
+    }
+
+    c = append_cluster(g);
+    c->representative = id;
+    c->kind = kind;
+    c->width = w;
+    c->height = h;
+    for (i = 0; i < (int) sizeof(Fingerprint); i++)
+        c->fingerprint[i] = f[i];
+    c->bits = bits;
+    c->next = g->table[chain];
+    g->table[chain] = g->count - 1;
+    return id;
+}
+
+
+/* ______________________________   testing   __________________________________ */
+
+#ifdef TESTING
+
+static void test_clusters(void)
+{
+    /* the same glyph at different offsets, and a wider one */
+    static unsigned char a[3][4] = {{0, 1, 1, 0}, {0, 1, 0, 0}, {0, 1, 1, 0}};
+    static unsigned char b[3][4] = {{1, 1, 0, 0}, {1, 0, 0, 0}, {1, 1, 0, 0}};
+    static unsigned char d[3][4] = {{1, 1, 1, 0}, {1, 0, 0, 0}, {1, 1, 1, 0}};
+    unsigned char *pa[3], *pb[3], *pd[3];
+    GlyphClusters g = create_glyph_clusters(0);
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        pa[i] = a[i];
+        pb[i] = b[i];
+        pd[i] = d[i];
+    }
+
+    assert(cluster_glyph(g, 10, 0, pa, 4, 3) == 10);
+    assert(cluster_glyph(g, 11, 0, pb, 4, 3) == 10);
+    assert(cluster_glyph(g, 12, 0, pd, 4, 3) == 12);
+    assert(cluster_glyph(g, 13, 1, pa, 4, 3) == 13);
+    assert(cluster_glyph(g, 14, 0, pd, 4, 3) == 12);
+    free_glyph_clusters(g);
+}
+
+static void test_equal_fingerprints(void)
+{
+    /* these have the same fingerprint, but differ in a pixel */
+    static unsigned char a[4][4] = {{1, 1, 1, 1}, {1, 0, 1, 0}, {0, 0, 1, 0}, {1, 0, 0, 0}};
+    static unsigned char b[4][4] = {{1, 1, 1, 1}, {1, 0, 1, 0}, {0, 0, 1, 0}, {1, 1, 0, 0}};
+    unsigned char *pa[4], *pb[4];
+    GlyphClusters g;
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        pa[i] = a[i];
+        pb[i] = b[i];
+    }
+
+    g = create_glyph_clusters(0);
+    assert(cluster_glyph(g, 0, 0, pa, 4, 4) == 0);
+    assert(cluster_glyph(g, 1, 0, pb, 4, 4) == 1);
+    assert(cluster_glyph(g, 2, 0, pa, 4, 4) == 0);
+    assert(cluster_glyph(g, 3, 0, pb, 4, 4) == 1);
+    free_glyph_clusters(g);
+
+    g = create_glyph_clusters(1);
+    assert(cluster_glyph(g, 0, 0, pa, 4, 4) == 0);
+    assert(cluster_glyph(g, 1, 0, pb, 4, 4) == 0);
+    free_glyph_clusters(g);
+}
+
+static TestFunction tests[] = {
+    test_clusters,
+    test_equal_fingerprints,
+    NULL
+};
+
+TestSuite cluster_suite = {"cluster", NULL, NULL, tests};
+
+#endif
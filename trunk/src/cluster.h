@@ -0,0 +1,61 @@
+/* Plasma OCR - an OCR engine
+ *
+ * cluster.h - grouping near-identical glyph images
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/* A page has the same glyphs over and over again, just a bit differently
+ * scanned. Glyphs with the same bounding box size and close fingerprints
+ * are put into one cluster; only the first glyph of a cluster
+ * (the representative) needs to be recognized.
+ *
+ * Unlike the result cache, this is an approximation:
+ * a glyph gets the reading of a glyph that merely looks very much like it.
+ * Only with threshold 0 must the glyphs be identical.
+ */
+
+
+#ifndef PLASMA_OCR_CLUSTER_H
+#define PLASMA_OCR_CLUSTER_H
+
+
+typedef struct GlyphClustersStruct *GlyphClusters;
+
+
+/* `threshold' is the largest squared fingerprint distance
+ * (see fingerprint_distance_squared()) within a cluster;
+ * 0 means identical bounding boxes with identical pixels.
+ */
+GlyphClusters create_glyph_clusters(long threshold);
+void free_glyph_clusters(GlyphClusters);
+
+/* Put a glyph into a cluster. Glyphs of different kinds (e.g. letters
+ * and words) never meet. Returns the id of the cluster's representative,
+ * which is `id' itself if the glyph starts a new cluster.
+ */
+int cluster_glyph(GlyphClusters, int id, int kind,
+                  unsigned char **pixels, int width, int height);
+
+
+#ifdef TESTING
+extern TestSuite cluster_suite;
+#endif
+
+
+#endif
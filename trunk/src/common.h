@@ -56,6 +56,15 @@
 #include <stdlib.h>
 
 
+/* Hand-written SIMD kernels for x86; each one is chosen at run time
+ * with __builtin_cpu_supports(). Define PLASMA_NO_SIMD to do without them.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+    && !defined(__STRICT_ANSI__) && !defined(PLASMA_NO_SIMD)
+#   define X86_KERNELS
+#endif
+
+
 #define MALLOC1(TYPE)           ( (TYPE *) malloc(sizeof(TYPE)) )
 #define MALLOC(TYPE, N)         ( (TYPE *) malloc((N) * sizeof(TYPE)) )
 #define REALLOC(TYPE, PTR, N)   ( (TYPE *) realloc(PTR, (N) * sizeof(TYPE)) )
@@ -7,51 +7,136 @@
 #include "bitmaps.h"
 #include "wordcut.h"
 #include "pattern.h"
+#include "topology.h"
+#include "vptree.h"
+#include "pqindex.h"
+#include "cache.h"
+#include "stats.h"
 #include <assert.h>
 #include <string.h>
 
 
+/* The number of results to remember by default. */
+#define DEFAULT_CACHE_SIZE 1024
+
+/* Kinds of cached results */
+#define CACHED_LETTER 0
+#define CACHED_WORD 1
+
+
 struct CoreStruct
 {
     int libraries_count, libraries_allocated;
     Library *libraries;
+
+    /* All the records with known text, in the library order.
+     * Their patterns are frozen for matching.
+     */
+    int catalog_count, catalog_allocated;
+    LibraryRecord **catalog;
+    FrozenPatterns frozen;
+    Pattern *catalog_patterns;      /* the frozen ones */
+    TopologyIndex topology;
+    FingerprintTree fingerprints;
+    FingerprintIndex fingerprint_index;     /* NULL unless turned on */
+    int shortlist;                          /* for the fingerprint index */
+
+    ResultCache results;
+    int orange_policy;
+    RecognitionContext context;     /* the default one */
+};
+
+
+struct RecognitionContextStruct
+{
+    Core core;
     int matches_count, matches_allocated;
     Match *matches;
-    int records_count, records_allocated;
-    LibraryRecord **records;
-    int orange_policy;
-    Library orange_library;
+    int found_count, found_allocated;
+    int *found;                     /* catalog indices of the matches */
+    Library orange_library;         /* created on demand */
 };
 
+
 static void init_libraries_list(Core c)
     LIST_CREATE(Library, c->libraries, c->libraries_count, c->libraries_allocated, 8)
 
 static Library *append_library(Core c)
     LIST_APPEND(Library, c->libraries, c->libraries_count, c->libraries_allocated)
 
-static void init_matches_list(Core c)
-    LIST_CREATE(Match, c->matches, c->matches_count, c->matches_allocated, 16)
+static void init_catalog(Core c)
+    LIST_CREATE(LibraryRecord *, c->catalog, c->catalog_count, c->catalog_allocated, 64)
+
+static LibraryRecord **append_to_catalog(Core c)
+    LIST_APPEND(LibraryRecord *, c->catalog, c->catalog_count, c->catalog_allocated)
+
+static void init_matches_list(RecognitionContext ctx)
+    LIST_CREATE(Match, ctx->matches, ctx->matches_count, ctx->matches_allocated, 16)
+
+static Match *append_match(RecognitionContext ctx)
+    LIST_APPEND(Match, ctx->matches, ctx->matches_count, ctx->matches_allocated)
+
+static void init_found_list(RecognitionContext ctx)
+    LIST_CREATE(int, ctx->found, ctx->found_count, ctx->found_allocated, 16)
+
+static int *append_found(RecognitionContext ctx)
+    LIST_APPEND(int, ctx->found, ctx->found_count, ctx->found_allocated)
 
-static Match *append_match(Core c)
-    LIST_APPEND(Match, c->matches, c->matches_count, c->matches_allocated)
 
-static void init_records_list(Core c)
-    LIST_CREATE(LibraryRecord *, c->records, c->records_count, c->records_allocated, 16)
+RecognitionContext create_recognition_context(Core c)
+{
+    RecognitionContext ctx = MALLOC1(struct RecognitionContextStruct);
+    ctx->core = c;
+    init_matches_list(ctx);
+    init_found_list(ctx);
+    ctx->orange_library = NULL;
+    return ctx;
+}
+
+void free_recognition_context(RecognitionContext ctx)
+{
+    if (ctx->orange_library)
+        library_free(ctx->orange_library);
+    FREE(ctx->matches);
+    FREE(ctx->found);
+    FREE1(ctx);
+}
 
-static LibraryRecord **append_record(Core c)
-    LIST_APPEND(LibraryRecord *, c->records, c->records_count, c->records_allocated)
+Library get_context_orange_library(RecognitionContext ctx)
+{
+    if (!ctx->core->orange_policy)
+        return NULL;
+    if (!ctx->orange_library)
+        ctx->orange_library = library_create();
+    return ctx->orange_library;
+}
 
 
 void set_core_orange_policy(Core c, int level)
 {
     c->orange_policy = level;
-    if (level)
-        c->orange_library = library_create();
 }
 
 Library get_core_orange_library(Core c)
 {
-    return c->orange_library;
+    return get_context_orange_library(c->context);
+}
+
+RecognitionContext get_core_context(Core c)
+{
+    return c->context;
+}
+
+
+void set_core_cache_size(Core c, int entries)
+{
+    free_result_cache(c->results);
+    c->results = create_result_cache(entries);
+}
+
+void get_core_cache_stats(Core c, long *hits, long *misses)
+{
+    get_result_cache_stats(c->results, hits, misses);
 }
 
 
@@ -59,10 +144,16 @@ Core create_core()
 {
     Core c = MALLOC1(struct CoreStruct);
     init_libraries_list(c);
-    init_matches_list(c);
-    init_records_list(c);
+    init_catalog(c);
+    c->frozen = NULL;
+    c->catalog_patterns = NULL;
+    c->topology = NULL;
+    c->fingerprints = NULL;
+    c->fingerprint_index = NULL;
+    c->shortlist = 0;
+    c->results = create_result_cache(DEFAULT_CACHE_SIZE);
     c->orange_policy = 0;
-    c->orange_library = NULL;
+    c->context = create_recognition_context(c);
     return c;
 }
 
@@ -73,17 +164,129 @@ void free_core(Core c)
     for (i = 0; i < c->libraries_count; i++)
         library_free(c->libraries[i]);
 
-    if (c->orange_library)
-        library_free(c->orange_library);
+    free_recognition_context(c->context);
+    free_result_cache(c->results);
+    if (c->topology)
+        free_topology_index(c->topology);
+    if (c->fingerprints)
+        free_fingerprint_tree(c->fingerprints);
+    if (c->fingerprint_index)
+        free_fingerprint_index(c->fingerprint_index);
+    if (c->frozen)
+        free_frozen_patterns(c->frozen);
+    if (c->catalog_patterns)
+        FREE(c->catalog_patterns);
+    FREE(c->catalog);
     FREE(c->libraries);
-    FREE(c->matches);
-    FREE(c->records);
     FREE1(c);
 }
 
+
+static Fingerprint *get_catalog_fingerprints(Core c)
+{
+    Fingerprint *fingerprints = MALLOC(Fingerprint, c->catalog_count + 1);
+    int i;
+    for (i = 0; i < c->catalog_count; i++)
+        memcpy(fingerprints[i], get_pattern_fingerprint(c->catalog_patterns[i]),
+               sizeof(Fingerprint));
+    return fingerprints;
+}
+
+
+static void index_fingerprints(Core c)
+{
+    Fingerprint *fingerprints = get_catalog_fingerprints(c);
+
+    if (c->fingerprints)
+        free_fingerprint_tree(c->fingerprints);
+    if (c->fingerprint_index)
+        free_fingerprint_index(c->fingerprint_index);
+
+    c->fingerprints = create_fingerprint_tree(c->catalog_count, fingerprints);
+    c->fingerprint_index = c->shortlist
+                         ? create_fingerprint_index(c->catalog_count, fingerprints)
+                         : NULL;
+    FREE(fingerprints);
+}
+
+
+/* Rebuild the indices over the catalog. */
+static void index_catalog(Core c)
+{
+    int i;
+
+    if (c->topology)
+        free_topology_index(c->topology);
+    if (c->frozen)
+        free_frozen_patterns(c->frozen);
+
+    c->catalog_patterns = REALLOC(Pattern, c->catalog_patterns, c->catalog_count);
+    for (i = 0; i < c->catalog_count; i++)
+        c->catalog_patterns[i] = c->catalog[i]->pattern;
+
+    c->frozen = freeze_patterns(c->catalog_count, c->catalog_patterns);
+    if (edit_distances_lanes() == 1)
+        build_frozen_rope_trie(c->frozen);   /* see compare_matches_batched() */
+    for (i = 0; i < c->catalog_count; i++)
+        c->catalog_patterns[i] = get_frozen_pattern(c->frozen, i);
+
+    c->topology = create_topology_index(c->catalog_count, c->catalog_patterns);
+    index_fingerprints(c);
+}
+
+
+void set_core_fingerprint_index(Core c, int shortlist)
+{
+    assert(shortlist >= 0);
+    c->shortlist = shortlist;
+    if (c->catalog_patterns)
+        index_fingerprints(c);
+    clear_result_cache(c->results);
+}
+
+
+/* Library patterns are promoted right here
+ * so that recognition never has to modify them.
+ */
 void add_to_core(Core c, Library l)
 {
+    LibraryIterator iter;
+    LibraryRecord *rec;
+
+    library_iterator_init(&iter, 1, &l);
+    while ((rec = library_iterator_next(&iter)))
+    {
+        assert(rec->pattern);
+        promote_pattern(rec->pattern);
+        if (rec->text[0])
+            *(append_to_catalog(c)) = rec;
+    }
+
     *(append_library(c)) = l;
+    index_catalog(c);
+    clear_result_cache(c->results);
+}
+
+
+/* With fewer matches, pruning by lower bounds wins over batching. */
+#define MIN_BATCH 32
+
+
+typedef struct
+{
+    int bound;          /* on the penalty */
+    int may_be_green;
+    int index;          /* in the matches list */
+} MatchBound;
+
+
+static int compare_match_bounds(const void *a, const void *b)
+{
+    const MatchBound *x = (const MatchBound *) a;
+    const MatchBound *y = (const MatchBound *) b;
+    if (x->bound != y->bound)
+        return x->bound < y->bound ? -1 : 1;
+    return x->index - y->index;
 }
 
 
@@ -119,143 +322,477 @@ static RecognizedLetter *create_recognized_letter(char *text, ColorCode c)
 }
 
 
-static void iterate_core(Core c, LibraryIterator *iter)
+/* Set the iterator to the state right after returning `target'.
+ * That's what explanations are made of.
+ */
+static void explain_record(Core c, LibraryRecord *target, LibraryIterator *iter)
 {
+    LibraryRecord *rec;
     library_iterator_init(iter, c->libraries_count, c->libraries);
+    while ((rec = library_iterator_next(iter)) && rec != target) {}
 }
 
 
-static RecognizedLetter *shiftcut_recognize(Core c, Pattern p, int need_explanation)
+typedef struct
 {
-    char *best = NULL;
-    long best_dist = 0x7FFFFFFFL;
-    LibraryIterator best_iter;
-    LibraryIterator iter;
-    LibraryRecord *rec;
+    Core core;
+    Pattern pattern;
+} ShiftcutQuery;
+
+static int shiftcut_applicable(int index, void *data)
+{
+    ShiftcutQuery *q = (ShiftcutQuery *) data;
+    return pattern_size_test(q->core->catalog_patterns[index], q->pattern);
+}
+
+
+/* Update `*nearest' (a catalog index or -1) and its squared fingerprint
+ * distance `*distance' if the candidate is nearer. Of equal ones,
+ * the first one tried stays.
+ */
+static void improve_nearest(Core c, Pattern p, int candidate, int *nearest, long *distance)
+{
+    long d = *nearest == -1
+           ? patterns_shiftcut_dist(c->catalog_patterns[candidate], p)
+           : patterns_shiftcut_dist_bounded(c->catalog_patterns[candidate], p, *distance - 1);
+
+    if (d != 0x7FFFFFFFL && (*nearest == -1 || d < *distance))
+    {
+        *nearest = candidate;
+        *distance = d;
+    }
+}
+
+
+/* Find the library record with the nearest fingerprint.
+ * The tree gives the same answer as trying patterns_shiftcut_dist()
+ * on all the catalog in order; the fingerprint index, if it's on,
+ * only looks at its shortlist.
+ * `best' is the nearest of the topology candidates tried so far (or -1),
+ * `best_distance' is its squared distance; the `count' candidates
+ * not tried yet are tried first.
+ */
+static RecognizedLetter *shiftcut_recognize(Core c, Pattern p, int need_explanation,
+                                            int count, const int *candidates,
+                                            int best, long best_distance)
+{
+    ShiftcutQuery q;
     RecognizedLetter *result;
+    int i;
 
-    iterate_core(c, &iter);
+    for (i = 0; i < count; i++)
+        improve_nearest(c, p, candidates[i], &best, &best_distance);
 
-    while ((rec = library_iterator_next(&iter)))
+    q.core = c;
+    q.pattern = p;
+    if (c->fingerprint_index)
     {
-        long dist;
-        if (!rec->text[0]) continue;
-        dist = patterns_shiftcut_dist(rec->pattern, p);
+        int *shortlist = MALLOC(int, c->shortlist);
+        int n = fingerprint_index_search(c->fingerprint_index, get_pattern_fingerprint(p),
+                                         c->shortlist, shortlist);
 
-        if (dist < best_dist)
+        for (i = 0; i < n; i++)
         {
-            best_dist = dist;
-            best = rec->text;
-            best_iter = iter;
+            int k = shortlist[i];
+            long d;
+            if (!shiftcut_applicable(k, &q))
+                continue;
+            d = fingerprint_distance_squared(get_pattern_fingerprint(p),
+                                             get_pattern_fingerprint(c->catalog_patterns[k]));
+            if (best == -1 || d < best_distance || (d == best_distance && k < best))
+            {
+                best = k;
+                best_distance = d;
+            }
         }
+        FREE(shortlist);
+    }
+    else if (c->fingerprints)
+    {
+        best = fingerprint_tree_improve(c->fingerprints, get_pattern_fingerprint(p),
+                                        shiftcut_applicable, &q, best, &best_distance);
     }
 
-    result = create_recognized_letter(best, (best ? CC_YELLOW : CC_RED));
+    if (best == -1)
+        result = create_recognized_letter(NULL, CC_RED);
+    else
+        result = create_recognized_letter(c->catalog[best]->text, CC_YELLOW);
 
     if (need_explanation)
     {
         result->best_match = MALLOC1(LibraryIterator);
-        *(result->best_match) = best_iter;
+        explain_record(c, best == -1 ? NULL : c->catalog[best], result->best_match);
     }
 
     return result;
 }
 
 
-RecognizedLetter *recognize_pattern(Core c, Pattern p, int need_explanation)
+/* Compare the pattern with all the matches and set good[i] for the green ones.
+ * Returns the index of the best match (the first one with the least penalty).
+ *
+ * The most promising matches go first; then the rest can be skipped
+ * unless their lower bounds let them be green or beat the best one.
+ */
+static int compare_matches_pruned(RecognitionContext ctx, Pattern p, char *good)
+{
+    Core c = ctx->core;
+    int n = ctx->matches_count;
+    MatchBound *order = MALLOC(MatchBound, n);
+    int best_match = -1;
+    int best_penalty = -1;
+    int penalty;
+    int i, k;
+
+    for (i = 0; i < n; i++)
+    {
+        order[i].index = i;
+        order[i].bound = compare_patterns_lower_bound(c->catalog[ctx->found[i]]->radius,
+                                                      ctx->matches[i],
+                                                      c->catalog_patterns[ctx->found[i]], p,
+                                                      &order[i].may_be_green);
+        good[i] = 0;
+    }
+    qsort(order, n, sizeof(MatchBound), compare_match_bounds);
+
+    for (k = 0; k < n; k++)
+    {
+        LibraryRecord *rec;
+        int cutoff;
+        int promising;
+
+        i = order[k].index;
+        promising = best_match == -1 || order[k].bound < best_penalty
+                 || (order[k].bound == best_penalty && i < best_match);
+        if (!promising && order[k].bound > 0)
+        {
+            /* the bounds are sorted, so none of the rest can do better */
+            STATS_ADD(STAT_PRUNED_BY_BOUND, n - k);
+            break;
+        }
+        if (!promising && !order[k].may_be_green)
+        {
+            STATS_COUNT_ONE(STAT_PRUNED_BY_BOUND);
+            continue;
+        }
+
+        /* only a better penalty than the best one matters */
+        if (best_match == -1)
+            cutoff = NO_CUTOFF;
+        else
+            cutoff = i < best_match ? best_penalty : best_penalty - 1;
+
+        rec = c->catalog[ctx->found[i]];
+        STATS_TIME(STAT_COMPARE_PATTERNS,
+                   good[i] = compare_patterns_bounded(rec->radius, ctx->matches[i],
+                                                      c->catalog_patterns[ctx->found[i]], p,
+                                                      cutoff, &penalty));
+
+        if (best_match == -1 || penalty < best_penalty
+         || (penalty == best_penalty && i < best_match))
+        {
+            best_match = i;
+            best_penalty = penalty;
+        }
+    }
+
+    FREE(order);
+    return best_match;
+}
+
+
+/* The batched comparison needs the same radius for all. */
+static int same_radius(RecognitionContext ctx)
+{
+    Core c = ctx->core;
+    int radius = c->catalog[ctx->found[0]]->radius;
+    int i;
+
+    for (i = 1; i < ctx->matches_count; i++)
+        if (c->catalog[ctx->found[i]]->radius != radius)
+            return 0;
+    return 1;
+}
+
+
+/* Same as compare_matches_pruned(), but computes all the penalties at once.
+ * That's faster when there are many matches. If there's a SIMD kernel,
+ * brute force over its lanes wins; otherwise walking the trie of library
+ * ropes does, since it shares the work on common prefixes.
+ */
+static int compare_matches_batched(RecognitionContext ctx, Pattern p, char *good)
+{
+    Core c = ctx->core;
+    int n = ctx->matches_count;
+    Pattern *patterns = MALLOC(Pattern, n);
+    int *goods = MALLOC(int, n);
+    int *penalties = MALLOC(int, n);
+    int radius = c->catalog[ctx->found[0]]->radius;
+    int best_match = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        patterns[i] = c->catalog_patterns[ctx->found[i]];
+
+    if (edit_distances_lanes() > 1)
+        STATS_TIME(STAT_COMPARE_PATTERNS,
+                   compare_patterns_many(radius, n, ctx->matches, patterns, p,
+                                         goods, penalties));
+    else
+    {
+        /* The best match can't cost more than any one match, and the walk
+         * drops the branches over that. So one match is compared first:
+         * the one with the least lower bound, as likely the best one.
+         */
+        int seed = 0, seed_bound = -1, cutoff;
+
+        for (i = 0; i < n; i++)
+        {
+            int may_be_green;
+            int bound = compare_patterns_lower_bound(radius, ctx->matches[i], patterns[i], p,
+                                                     &may_be_green);
+            if (seed_bound == -1 || bound < seed_bound)
+            {
+                seed = i;
+                seed_bound = bound;
+            }
+        }
+
+        STATS_TIME(STAT_COMPARE_PATTERNS,
+            compare_patterns(radius, ctx->matches[seed], patterns[seed], p, &cutoff);
+            compare_frozen_patterns_many(c->frozen, radius, cutoff, n,
+                                         ctx->matches, patterns, p, goods, penalties));
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        good[i] = goods[i];
+        if (penalties[i] < penalties[best_match])
+            best_match = i;
+    }
+
+    FREE(patterns);
+    FREE(goods);
+    FREE(penalties);
+    return best_match;
+}
+
+
+RecognizedLetter *recognize_pattern_in_context(RecognitionContext ctx,
+                                               Pattern p, int need_explanation)
 {
     /* First, match to everything */
 
+    Core c = ctx->core;
     int i;
-    LibraryRecord *rec;
-    LibraryIterator iter;
+    const int *candidates;
+    int candidates_count;
     RecognizedLetter *result;
+    int nearest = -1;           /* by fingerprint, among the first `tried' candidates */
+    long nearest_distance = 0;
+    int tried = 0;
 
-    c->matches_count = 0;
-    c->records_count = 0;
-    iterate_core(c, &iter);
+    ctx->matches_count = 0;
+    ctx->found_count = 0;
 
-    while ((rec = library_iterator_next(&iter)))
+    /* Only the patterns of the same topology have a chance */
+    candidates_count = c->topology
+                     ? topology_index_lookup(c->topology, p, &candidates)
+                     : 0;
+
+    STATS_ADD(STAT_CANDIDATES, c->catalog_count);
+    STATS_ADD(STAT_PRUNED_BY_TOPOLOGY, c->catalog_count - candidates_count);
+
+    for (i = 0; i < candidates_count; i++)
     {
+        Pattern candidate = c->catalog_patterns[candidates[i]];
         Match m;
-        if (rec->text[0] == '\0') continue;
-        m = match_patterns(rec->pattern, p);
-        assert(rec->pattern);
+
+        /* Until something matches, the letter can't be green or blue,
+         * so the nearest fingerprint for shiftcut_recognize() is looked for on the way.
+         */
+        if (!ctx->matches_count)
+        {
+            improve_nearest(c, p, candidates[i], &nearest, &nearest_distance);
+            tried = i + 1;
+        }
+
+        STATS_TIME(STAT_MATCH_PATTERNS, m = match_patterns(candidate, p));
         if (m)
         {
-            * (append_match(c)) = m;
-            * (append_record(c)) = rec;
+            * (append_match(ctx)) = m;
+            * (append_found(ctx)) = candidates[i];
         }
     }
 
-    if (!c->matches_count)
+    STATS_ADD(STAT_MATCHES, ctx->matches_count);
+
+    if (!ctx->matches_count)
         result = create_recognized_letter(NULL, CC_RED);
     else
     {
-        Match *good_matches = MALLOC(Match, c->matches_count);
-        LibraryRecord **good_samples = MALLOC(LibraryRecord *, c->matches_count);
+        int n = ctx->matches_count;
+        Match *good_matches = MALLOC(Match, n);
+        LibraryRecord **good_samples = MALLOC(LibraryRecord *, n);
+        char *good = MALLOC(char, n);
         int good_matches_found = 0;
-        int best_match = -1;
-        int best_penalty = -1;
-        int penalty;
+        int best_match;
 
         /* Another pass over matches, this time with ED-comparison */
-        for (i = 0; i < c->matches_count; i++)
+        if (n >= MIN_BATCH && same_radius(ctx))
+            best_match = compare_matches_batched(ctx, p, good);
+        else
+            best_match = compare_matches_pruned(ctx, p, good);
+
+        for (i = 0; i < n; i++)
         {
-            if (compare_patterns(c->records[i]->radius, c->matches[i], c->records[i]->pattern, p, &penalty))
+            if (good[i])
             {
-                good_matches[good_matches_found] = c->matches[i];
-                good_samples[good_matches_found] = c->records[i];
+                good_matches[good_matches_found] = ctx->matches[i];
+                good_samples[good_matches_found] = c->catalog[ctx->found[i]];
                 good_matches_found++;
             }
-
-            if (i == 0 || penalty < best_penalty)
-            {
-                best_match = i;
-                best_penalty = penalty;
-            }
         }
 
         if (!good_matches_found)
-            result = create_recognized_letter(c->records[best_match]->text, CC_YELLOW);
+            result = create_recognized_letter(c->catalog[ctx->found[best_match]]->text, CC_YELLOW);
         else if (samples_conflict(good_samples, good_matches_found))
-            result = create_recognized_letter(c->records[best_match]->text, CC_BLUE);
+            result = create_recognized_letter(c->catalog[ctx->found[best_match]]->text, CC_BLUE);
         else
             result = create_recognized_letter(good_samples[0]->text, CC_GREEN);
 
         FREE(good_matches);
         FREE(good_samples);
+        FREE(good);
     }
 
     if (result->color == CC_RED || result->color == CC_YELLOW)
     {
-        RecognizedLetter *alternative = shiftcut_recognize(c, p, need_explanation);
+        RecognizedLetter *alternative;
+        STATS_TIME(STAT_SHIFTCUT,
+                   alternative = shiftcut_recognize(c, p, need_explanation,
+                                                    candidates_count - tried, candidates + tried,
+                                                    nearest, nearest_distance));
         if (result)
             free_recognized_letter(result);
 
         result = alternative;
     }
 
-    for (i = 0; i < c->matches_count; i++)
-        destroy_match(c->matches[i]);
+    for (i = 0; i < ctx->matches_count; i++)
+        destroy_match(ctx->matches[i]);
 
     return result;
 }
 
 
+RecognizedLetter *recognize_pattern(Core c, Pattern p, int need_explanation)
+{
+    return recognize_pattern_in_context(c->context, p, need_explanation);
+}
+
+
 
-RecognizedLetter *recognize_letter(Core c,
-                                   unsigned char **pixels, int width, int height,
-                                   int need_explanation)
+/* ______________________________   result cache   __________________________________ */
+
+
+static int needs_orange(Core c, ColorCode cc)
+{
+    return c->orange_policy && (cc == CC_RED || cc == CC_YELLOW);
+}
+
+
+/* A letter depends on its bounding box and, through the fingerprint,
+ * on the offset of the box. So only the right and bottom margins
+ * may be dropped from the key.
+ */
+static void get_letter_key_size(unsigned char **pixels, int width, int height,
+                                int *w, int *h)
+{
+    int b_x, b_y, b_w, b_h;
+
+    if (find_bbox(pixels, width, height, &b_x, &b_y, &b_w, &b_h))
+    {
+        *w = b_x + b_w;
+        *h = b_y + b_h;
+    }
+    else
+    {
+        *w = 1;
+        *h = 1;
+    }
+}
+
+
+static RecognizedLetter *cached_letter(CachedResult *r, int i)
 {
-    Pattern p = create_pattern(pixels, width, height);
-    RecognizedLetter *result = recognize_pattern(c, p, need_explanation);
-    int cc = result->color;
-    if (c->orange_policy && (cc == CC_RED || cc == CC_YELLOW))
+    return create_recognized_letter(r->texts[i], r->colors[i]);
+}
+
+
+static void cache_letters(Core c, int kind,
+                          unsigned char **pixels, int w, int h,
+                          int count, RecognizedLetter **letters)
+{
+    CachedResult r;
+    int i;
+
+    r.count = count;
+    r.colors = MALLOC(ColorCode, count);
+    r.texts = MALLOC(char *, count);
+    for (i = 0; i < count; i++)
+    {
+        r.colors[i] = letters[i]->color;
+        r.texts[i] = letters[i]->text;
+    }
+    result_cache_store(c->results, kind, pixels, 0, 0, w, h, &r);
+    FREE(r.colors);
+    FREE(r.texts);
+}
+
+
+/* ______________________________   letters and words   __________________________________ */
+
+
+RecognizedLetter *recognize_letter_in_context(RecognitionContext ctx,
+                                              unsigned char **pixels,
+                                              int width, int height,
+                                              int need_explanation)
+{
+    Core c = ctx->core;
+    Pattern p = NULL;
+    RecognizedLetter *result = NULL;
+    int key_w, key_h;
+
+    /* Explanations point into the libraries, so they aren't cached. */
+    get_letter_key_size(pixels, width, height, &key_w, &key_h);
+    if (!need_explanation)
+    {
+        CachedResult *r = result_cache_lookup(c->results, CACHED_LETTER,
+                                              pixels, 0, 0, key_w, key_h);
+        if (r)
+        {
+            result = cached_letter(r, 0);
+            free_cached_result(r);
+        }
+    }
+
+    if (!result)
     {
-        Shelf *s = shelf_create(c->orange_library);
+        STATS_TIME(STAT_CREATE_PATTERN, p = create_pattern(pixels, width, height));
+        result = recognize_pattern_in_context(ctx, p, need_explanation);
+        cache_letters(c, CACHED_LETTER, pixels, key_w, key_h, 1, &result);
+    }
+
+    if (needs_orange(c, result->color))
+    {
+        Shelf *s = shelf_create(get_context_orange_library(ctx));
         LibraryRecord *rec = shelf_append(s);
 
+        /* the pattern is the same as the one we'd recognize */
+        if (!p)
+            STATS_TIME(STAT_CREATE_PATTERN, p = create_pattern(pixels, width, height));
+
         s->pixels = copy_bitmap(pixels, width, height);
         s->width = width;
         s->height = height;
@@ -272,13 +809,22 @@ RecognizedLetter *recognize_letter(Core c,
         rec->width = width;
         rec->height = height;
     }
-    else
+    else if (p)
         free_pattern(p);
 
     return result;
 }
 
 
+RecognizedLetter *recognize_letter(Core c,
+                                   unsigned char **pixels, int width, int height,
+                                   int need_explanation)
+{
+    return recognize_letter_in_context(c->context, pixels, width, height,
+                                       need_explanation);
+}
+
+
 void free_recognized_letter(RecognizedLetter *r)
 {
     if (r->text) FREE(r->text);
@@ -312,17 +858,66 @@ static void build_recognized_word_text(RecognizedWord *rw)
 }
 
 
-RecognizedWord *recognize_word(Core c,
-                               unsigned char **pixels, int width, int height,
-                               int need_explanation)
+/* Make a word out of the cached result.
+ * If some of the letters should go into the orange library,
+ * we have to do the whole job anyway, so return NULL.
+ */
+static RecognizedWord *cached_word(Core c, CachedResult *r)
+{
+    RecognizedWord *rw;
+    int i;
+
+    for (i = 0; i < r->count; i++)
+        if (needs_orange(c, r->colors[i]))
+            return NULL;
+
+    rw = MALLOC1(RecognizedWord);
+    rw->count = r->count;
+    rw->letters = MALLOC(RecognizedLetter *, r->count);
+    for (i = 0; i < r->count; i++)
+        rw->letters[i] = cached_letter(r, i);
+    build_recognized_word_text(rw);
+    return rw;
+}
+
+
+RecognizedWord *recognize_word_in_skeleton(RecognitionContext ctx,
+                                           unsigned char **pixels,
+                                           unsigned char **skeleton,
+                                           int width, int height,
+                                           int need_explanation)
 {
-    PatternCache pc = create_pattern_cache(pixels, width, height);
+    Core c = ctx->core;
+    PatternCache pc;
     Pattern p;
     Shelf *s = NULL;
-    WordCut *wc = cut_word(pixels, width, height);
-    int count = wc->count + 1;  /* the number of chunks is number of cuts + 1 */
+    WordCut *wc;
+    int count;
     int i;
-    RecognizedWord *rw = MALLOC1(RecognizedWord);
+    RecognizedWord *rw;
+
+    /* Words are cut by their whole rectangle, so that's the key. */
+    if (!need_explanation)
+    {
+        CachedResult *r = result_cache_lookup(c->results, CACHED_WORD,
+                                              pixels, 0, 0, width, height);
+        if (r)
+        {
+            rw = cached_word(c, r);
+            free_cached_result(r);
+            if (rw)
+                return rw;
+        }
+    }
+
+    if (skeleton)
+        pc = create_pattern_cache_with_skeleton(pixels, width, height, skeleton);
+    else
+        pc = create_pattern_cache(pixels, width, height);
+    STATS_TIME(STAT_CUT_WORD, wc = cut_word_in_projection(pixels, width, height,
+                                                  get_pattern_cache_projection(pc)));
+    count = wc->count + 1;  /* the number of chunks is number of cuts + 1 */
+    rw = MALLOC1(RecognizedWord);
     rw->count = count;
     rw->letters = MALLOC(RecognizedLetter *, count);
 
@@ -342,19 +937,20 @@ RecognizedWord *recognize_word(Core c,
             x_end = width;
 
         assert(x_end > x_beg);
-        p = create_pattern_from_cache(pixels, width, height,
-                                      x_beg, 0, x_end - x_beg, height, pc);
+        STATS_TIME(STAT_CREATE_PATTERN,
+                   p = create_pattern_from_cache(pixels, width, height,
+                                                 x_beg, 0, x_end - x_beg, height, pc));
 
-        rw->letters[i] = recognize_pattern(c, p, need_explanation);
+        rw->letters[i] = recognize_pattern_in_context(ctx, p, need_explanation);
 
         /* XXX too much code duplicated with recognize_letter */
         cc = rw->letters[i]->color;
-        if (c->orange_policy && (cc == CC_RED || cc == CC_YELLOW))
+        if (needs_orange(c, cc))
         {
             LibraryRecord *rec;
             if (!s)
             {
-                s = shelf_create(c->orange_library);
+                s = shelf_create(get_context_orange_library(ctx));
                 s->pixels = copy_bitmap(pixels, width, height);
                 s->width = width;
                 s->height = height;
@@ -378,6 +974,8 @@ RecognizedWord *recognize_word(Core c,
             free_pattern(p);
     }
 
+    cache_letters(c, CACHED_WORD, pixels, width, height, count, rw->letters);
+
     build_recognized_word_text(rw);
     destroy_word_cut(wc);
     destroy_pattern_cache(pc);
@@ -385,6 +983,25 @@ RecognizedWord *recognize_word(Core c,
     return rw;
 }
 
+
+RecognizedWord *recognize_word_in_context(RecognitionContext ctx,
+                                          unsigned char **pixels,
+                                          int width, int height,
+                                          int need_explanation)
+{
+    return recognize_word_in_skeleton(ctx, pixels, NULL, width, height,
+                                      need_explanation);
+}
+
+
+RecognizedWord *recognize_word(Core c,
+                               unsigned char **pixels, int width, int height,
+                               int need_explanation)
+{
+    return recognize_word_in_context(c->context, pixels, width, height,
+                                     need_explanation);
+}
+
 void free_recognized_word(RecognizedWord *rw)
 {
     int i;
@@ -13,6 +13,37 @@ void add_to_core(Core, Library l);
 void set_core_orange_policy(Core, int level);
 Library get_core_orange_library(Core);
 
+/* Recognition results are cached by exact bitmaps (see cache.h).
+ * The size is in entries, 0 turns the cache off.
+ * Don't change it while recognition is going on.
+ */
+void set_core_cache_size(Core, int entries);
+
+/* For huge libraries: find the shift-n-cut guess among `shortlist' candidates
+ * of an approximate index (see pqindex.h) instead of the exact search.
+ * 0 (the default) turns the index off.
+ * Don't change it while recognition is going on.
+ */
+void set_core_fingerprint_index(Core, int shortlist);
+void get_core_cache_stats(Core, long *hits, long *misses);
+
+
+/* A recognition context holds the scratch state of recognize_*() calls
+ * and the orange library collected through it.
+ * The core itself is not changed by recognition (except for the result
+ * cache, which has a lock of its own), so several threads may share
+ * one core as long as each of them has its own context.
+ * A core has a default context that is used by the functions taking a Core.
+ */
+typedef struct RecognitionContextStruct *RecognitionContext;
+
+RecognitionContext create_recognition_context(Core);
+void free_recognition_context(RecognitionContext);
+Library get_context_orange_library(RecognitionContext);
+
+/* The default context (don't free it). */
+RecognitionContext get_core_context(Core);
+
 typedef enum
 {
     CC_RED,     /* what was that? */
@@ -38,6 +69,14 @@ RecognizedLetter *recognize_letter(Core c,
                                    unsigned char **pixels, int width, int height,
                                    int need_explanation);
 
+RecognizedLetter *recognize_pattern_in_context(RecognitionContext,
+                                               Pattern p, int need_explanation);
+
+RecognizedLetter *recognize_letter_in_context(RecognitionContext,
+                                              unsigned char **pixels,
+                                              int width, int height,
+                                              int need_explanation);
+
 void free_recognized_letter(RecognizedLetter *);
 
 
@@ -52,6 +91,21 @@ RecognizedWord *recognize_word(Core c,
                                unsigned char **pixels, int width, int height,
                                int need_explanations);
 
+RecognizedWord *recognize_word_in_context(RecognitionContext,
+                                          unsigned char **pixels,
+                                          int width, int height,
+                                          int need_explanations);
+
+/* The same, but the skeleton of the pixels (see skeletonize()) is already known,
+ * e.g. it's a window of skeletonize_page() that's isolated (see bitmaps.h).
+ * NULL means unknown.
+ */
+RecognizedWord *recognize_word_in_skeleton(RecognitionContext,
+                                           unsigned char **pixels,
+                                           unsigned char **skeleton,
+                                           int width, int height,
+                                           int need_explanations);
+
 void free_recognized_word(RecognizedWord *);
 
 
@@ -1,99 +1,1294 @@
-#include "common.h"
-#include "editdist.h"
-#include <string.h>
-#include <stdio.h>
-
-#define REPLACE_PENALTY 100
-#define SHIFT_PENALTY   100
-#define SWAP_PENALTY     50
-#define MATCH_PENALTY   (-radius) /* KLUGE... */
-
-
-int edit_distance(int radius, const char *s1, int n1, const char *s2, int n2)
-{
-    /* We're going to fill a table.
-     * We need only three consecutive rows.
-     */
-    
-    int *table = (int *) malloc(3 * (n1 + 1) * sizeof(int));
-    int *row0 = table;
-    int *row1 = row0 + n1 + 1;
-    int *row2 = row1 + n1 + 1;
-    int result;
-    int i;
-
-    for (i = 0; i <= n2; i++)
-    {
-        int j;
-        int *tmp;
-
-        /* fill row2 (row1 is immediately above, row0 is above row1) */
-        row2[0] = i * SHIFT_PENALTY;
-        
-        for (j = 1; j <= n1; j++)
-        {
-            int best = row2[j-1] + SHIFT_PENALTY;
-
-            if (i > 0)
-            {
-                int delete_way = row1[j] + SHIFT_PENALTY;
-                int rep_penalty = (s1[j-1] == s2[i-1] ? MATCH_PENALTY : REPLACE_PENALTY);
-                int replace_way = row1[j-1] + rep_penalty;
-
-                if (delete_way < best)
-                    best = delete_way;
-                if (replace_way < best)
-                    best = replace_way;
-            }
-
-            if (i > 1 && j > 1 && s1[j-1] == s2[i-2] && s1[j-2] == s2[i-1])
-            {
-                int swap_way = row0[j-2] + SWAP_PENALTY;
-                if (swap_way < best)
-                    best = swap_way;
-            }
-            row2[j] = best;
-        }
-
-        /* rotate: row2 into row1, etc */
-        tmp = row0;
-        row0 = row1;
-        row1 = row2;
-        row2 = tmp;
-    }
-
-    result = row1[n1];
-    free(table);
-    return result;
-}
-
-
-#ifdef TESTING
-
-static void ed(int radius, const char *s1, const char *s2, int result)
-{
-    int n1 = strlen(s1);
-    int n2 = strlen(s2);
-    assert(edit_distance(radius, s1, n1, s2, n2) == result);
-    assert(edit_distance(radius, s2, n2, s1, n1) == result);
-}
-
-static void test_ed(void)
-{
-    /* TODO: better tests */
-    int radius = 100;
-    ed(radius, "a", "b", REPLACE_PENALTY);
-    ed(radius, "ab", "ab", 2*MATCH_PENALTY);
-    ed(radius, "a", "ab", MATCH_PENALTY + SHIFT_PENALTY);
-    ed(radius, "aba", "aab", MATCH_PENALTY + SWAP_PENALTY);
-}
-
-static TestFunction tests[] = {
-    test_ed,
-    NULL
-};
-
-TestSuite editdist_suite = {"editdist", NULL, NULL, tests};
-
-
-#endif
+#include "common.h"
+#include "editdist.h"
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+
+#ifdef X86_KERNELS
+#   include <immintrin.h>
+#endif
+
+#define REPLACE_PENALTY 100
+#define SHIFT_PENALTY   100
+#define SWAP_PENALTY     50
+#define MATCH_PENALTY   (-radius) /* KLUGE... */
+
+/* No letter is equal to that. */
+#define NO_LETTER (-1)
+
+
+/* ______________________________   the cache   __________________________________ */
+
+
+/* The same pairs of ropes come again and again (repeated glyphs,
+ * re-segmented words, library records with equal ropes), so we remember
+ * the distances. The cache is direct-mapped: a new pair just replaces
+ * whatever was in its slot. Strings are kept to check for hash collisions,
+ * so the longer ones aren't cached at all.
+ * Each thread has a cache of its own, so there's no locking on the way;
+ * only the hit and miss counters of all threads are summed up on request.
+ */
+
+#define MAX_CACHED_LENGTH 40
+#define DEFAULT_CACHE_SIZE 4096
+
+
+typedef struct
+{
+    unsigned long hash1, hash2;
+    int radius;
+    int n1, n2;                 /* n1 == -1 for an empty slot */
+    int distance;
+    char s1[MAX_CACHED_LENGTH];
+    char s2[MAX_CACHED_LENGTH];
+} CacheEntry;
+
+
+typedef struct ThreadCacheStruct ThreadCache;
+
+struct ThreadCacheStruct
+{
+    CacheEntry *entries;        /* NULL until the first use */
+    int size;                   /* of `entries' */
+    int generation;             /* of cache_size that `entries' were made for */
+    long hits, misses;
+    ThreadCache *next;          /* in the list of all threads' caches */
+};
+
+
+static int cache_size = DEFAULT_CACHE_SIZE;     /* a power of 2 or 0 */
+static int cache_generation = 0;                /* changes with cache_size */
+
+static __thread ThreadCache *local_cache;
+static ThreadCache *all_caches;
+static long retired_hits = 0, retired_misses = 0;   /* of the threads that are gone */
+static pthread_mutex_t caches_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Only for its destructor, which frees a cache when its thread exits. */
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+
+typedef struct
+{
+    unsigned long hash1, hash2;
+    int slot;                   /* -1 if the pair can't be cached */
+} CacheKey;
+
+
+/* FNV-1a; 64 bits where long is that long. */
+#if ULONG_MAX > 0xFFFFFFFFUL
+#   define FNV_BASIS 14695981039346656037UL
+#   define FNV_PRIME 1099511628211UL
+#else
+#   define FNV_BASIS 2166136261UL
+#   define FNV_PRIME 16777619UL
+#endif
+
+static unsigned long hash_string(const char *s, int n)
+{
+    unsigned long hash = FNV_BASIS;
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        hash ^= (unsigned char) s[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+
+static void free_local_cache(void *data)
+{
+    ThreadCache *c = (ThreadCache *) data;
+    ThreadCache **link;
+
+    pthread_mutex_lock(&caches_mutex);
+    for (link = &all_caches; *link != c; link = &(*link)->next) {}
+    *link = c->next;
+    retired_hits += c->hits;
+    retired_misses += c->misses;
+    pthread_mutex_unlock(&caches_mutex);
+
+    if (c->entries)
+        FREE(c->entries);
+    FREE1(c);
+    local_cache = NULL;
+}
+
+
+static void create_cache_key(void)
+{
+    pthread_key_create(&cache_key, free_local_cache);
+}
+
+
+/* This thread's cache, (re)allocated to the current size on first use. */
+static ThreadCache *get_local_cache(void)
+{
+    ThreadCache *c = local_cache;
+    int i;
+
+    if (!c)
+    {
+        c = MALLOC1(ThreadCache);
+        c->entries = NULL;
+        c->size = 0;
+        c->generation = -1;
+        c->hits = c->misses = 0;
+        pthread_mutex_lock(&caches_mutex);
+        c->next = all_caches;
+        all_caches = c;
+        pthread_mutex_unlock(&caches_mutex);
+        local_cache = c;
+
+        pthread_once(&cache_key_once, create_cache_key);
+        pthread_setspecific(cache_key, c);
+    }
+
+    if (c->generation != cache_generation)
+    {
+        if (c->entries)
+            FREE(c->entries);
+        c->size = cache_size;
+        c->entries = c->size ? MALLOC(CacheEntry, c->size) : NULL;
+        for (i = 0; i < c->size; i++)
+            c->entries[i].n1 = -1;
+        c->generation = cache_generation;
+    }
+
+    return c;
+}
+
+
+static void make_key(CacheKey *key, int radius, const char *s1, int n1, const char *s2, int n2)
+{
+    key->slot = -1;
+    if (n1 > MAX_CACHED_LENGTH || n2 > MAX_CACHED_LENGTH || !cache_size)
+        return;
+    key->hash1 = hash_string(s1, n1);
+    key->hash2 = hash_string(s2, n2);
+    key->slot = (int) ((key->hash1 ^ (key->hash2 * 31) ^ (unsigned long) radius * 0x9E3779B1UL)
+                       & (unsigned long) (cache_size - 1));
+}
+
+
+static int cache_lookup(CacheKey *key, int radius, const char *s1, int n1,
+                        const char *s2, int n2, int *distance)
+{
+    ThreadCache *c;
+    CacheEntry *e;
+
+    if (key->slot == -1)
+        return 0;
+
+    c = get_local_cache();
+    if (key->slot >= c->size)
+        return 0;
+
+    e = &c->entries[key->slot];
+    if (e->n1 == n1 && e->n2 == n2 && e->radius == radius
+     && e->hash1 == key->hash1 && e->hash2 == key->hash2
+     && !memcmp(e->s1, s1, n1) && !memcmp(e->s2, s2, n2))
+    {
+        *distance = e->distance;
+        c->hits++;
+        return 1;
+    }
+
+    c->misses++;
+    return 0;
+}
+
+
+static void cache_store(CacheKey *key, int radius, const char *s1, int n1,
+                        const char *s2, int n2, int distance)
+{
+    ThreadCache *c;
+    CacheEntry *e;
+
+    if (key->slot == -1)
+        return;
+
+    c = get_local_cache();
+    if (key->slot >= c->size)
+        return;
+
+    e = &c->entries[key->slot];
+    e->hash1 = key->hash1;
+    e->hash2 = key->hash2;
+    e->radius = radius;
+    e->n1 = n1;
+    e->n2 = n2;
+    e->distance = distance;
+    memcpy(e->s1, s1, n1);
+    memcpy(e->s2, s2, n2);
+}
+
+
+/* Threads notice the new size on their next lookup. */
+void set_edit_distance_cache_size(int entries)
+{
+    int size = 0;
+
+    assert(entries >= 0);
+    if (entries)
+        for (size = 1; size * 2 <= entries; size *= 2) {}
+
+    pthread_mutex_lock(&caches_mutex);
+    cache_size = size;
+    cache_generation++;
+    pthread_mutex_unlock(&caches_mutex);
+}
+
+
+void get_edit_distance_cache_stats(long *hits, long *misses)
+{
+    ThreadCache *c;
+    long h, m;
+
+    pthread_mutex_lock(&caches_mutex);
+    h = retired_hits;
+    m = retired_misses;
+    for (c = all_caches; c; c = c->next)
+    {
+        h += c->hits;
+        m += c->misses;
+    }
+    pthread_mutex_unlock(&caches_mutex);
+
+    if (hits) *hits = h;
+    if (misses) *misses = m;
+}
+
+
+int edit_distance_rows(int radius, const char *s1, int n1, const char *s2, int n2)
+{
+    /* We're going to fill a table.
+     * We need only three consecutive rows.
+     */
+    
+    int *table = (int *) malloc(3 * (n1 + 1) * sizeof(int));
+    int *row0 = table;
+    int *row1 = row0 + n1 + 1;
+    int *row2 = row1 + n1 + 1;
+    int result;
+    int i;
+
+    for (i = 0; i <= n2; i++)
+    {
+        int j;
+        int *tmp;
+
+        /* fill row2 (row1 is immediately above, row0 is above row1) */
+        row2[0] = i * SHIFT_PENALTY;
+        
+        for (j = 1; j <= n1; j++)
+        {
+            int best = row2[j-1] + SHIFT_PENALTY;
+
+            if (i > 0)
+            {
+                int delete_way = row1[j] + SHIFT_PENALTY;
+                int rep_penalty = (s1[j-1] == s2[i-1] ? MATCH_PENALTY : REPLACE_PENALTY);
+                int replace_way = row1[j-1] + rep_penalty;
+
+                if (delete_way < best)
+                    best = delete_way;
+                if (replace_way < best)
+                    best = replace_way;
+            }
+
+            if (i > 1 && j > 1 && s1[j-1] == s2[i-2] && s1[j-2] == s2[i-1])
+            {
+                int swap_way = row0[j-2] + SWAP_PENALTY;
+                if (swap_way < best)
+                    best = swap_way;
+            }
+            row2[j] = best;
+        }
+
+        /* rotate: row2 into row1, etc */
+        tmp = row0;
+        row0 = row1;
+        row1 = row2;
+        row2 = tmp;
+    }
+
+    result = row1[n1];
+    free(table);
+    return result;
+}
+
+
+/* ______________________________   anti-diagonals   __________________________________ */
+
+
+/* Long strings only: below that, the row-by-row loop is faster.
+ * See `bench wavefront' for where the lines cross.
+ */
+#define WAVEFRONT_MIN_LENGTH 24
+
+
+/* The cells on an anti-diagonal i + j = d don't depend on each other:
+ * (i, j) needs (i, j-1) and (i-1, j) from d - 1, (i-1, j-1) from d - 2
+ * and (i-2, j-2) from d - 4. So we keep five anti-diagonals indexed by i
+ * and fill each one with SIMD.
+ *
+ * To make the letters of s1 go the same way as i, s1 is reversed:
+ * s1[j-1] is letters1[n1 - d + i].
+ */
+
+#ifdef X86_KERNELS
+
+/* The cell (i, j = d - i) given the anti-diagonals d-1, d-2, d-4. */
+static int wavefront_cell(int radius, int i, int k1,
+                          const int *letters1, const int *letters2,
+                          const int *d1, const int *d2, const int *d4)
+{
+    int best = d1[i] + SHIFT_PENALTY;
+    int up = d1[i-1] + SHIFT_PENALTY;
+    int replace_way = d2[i-1] + (letters1[k1] == letters2[i] ? MATCH_PENALTY : REPLACE_PENALTY);
+
+    if (up < best)
+        best = up;
+    if (replace_way < best)
+        best = replace_way;
+    if (letters1[k1] == letters2[i-1] && letters1[k1+1] == letters2[i])
+    {
+        int swap_way = d4[i-2] + SWAP_PENALTY;
+        if (swap_way < best)
+            best = swap_way;
+    }
+    return best;
+}
+
+
+__attribute__((target("avx2")))
+static int wavefront_avx2(int radius, const char *s1, int n1, const char *s2, int n2)
+{
+    __m256i shift = _mm256_set1_epi32(SHIFT_PENALTY);
+    __m256i match = _mm256_set1_epi32(MATCH_PENALTY);
+    __m256i replace = _mm256_set1_epi32(REPLACE_PENALTY);
+    __m256i swap = _mm256_set1_epi32(SWAP_PENALTY);
+    int width = n2 + 3;             /* i goes from -2 to n2 */
+    int *buffers = MALLOC(int, 5 * width);
+    int *letters1 = MALLOC(int, n1 + 1);
+    int *letters2 = MALLOC(int, n2 + 1);
+    int *diagonals[5];              /* d, d-1, ..., d-4 */
+    int d, i, result;
+
+    /* the swap term peeks outside of the table, but its result is masked */
+    memset(buffers, 0, 5 * width * sizeof(int));
+    for (i = 0; i < 5; i++)
+        diagonals[i] = buffers + i * width + 2;
+    for (i = 0; i < n1; i++)
+        letters1[i] = (unsigned char) s1[n1 - 1 - i];
+    letters1[n1] = NO_LETTER;
+    letters2[0] = NO_LETTER;
+    for (i = 1; i <= n2; i++)
+        letters2[i] = (unsigned char) s2[i - 1];
+
+    for (d = 0; d <= n1 + n2; d++)
+    {
+        int *cur = diagonals[4];    /* d-5 isn't needed anymore */
+        int *d1 = diagonals[0], *d2 = diagonals[1], *d4 = diagonals[3];
+        int from = d - n1 > 1 ? d - n1 : 1;
+        int to = d - 1 < n2 ? d - 1 : n2;
+
+        if (d <= n1)
+            cur[0] = d * SHIFT_PENALTY;
+        if (d <= n2)
+            cur[d] = d * SHIFT_PENALTY;
+
+        for (i = from; i + 7 <= to; i += 8)
+        {
+            int k1 = n1 - d + i;
+            __m256i c1 = _mm256_loadu_si256((__m256i *) (letters1 + k1));
+            __m256i c1_next = _mm256_loadu_si256((__m256i *) (letters1 + k1 + 1));
+            __m256i c2 = _mm256_loadu_si256((__m256i *) (letters2 + i));
+            __m256i c2_prev = _mm256_loadu_si256((__m256i *) (letters2 + i - 1));
+            __m256i left = _mm256_loadu_si256((__m256i *) (d1 + i));
+            __m256i up = _mm256_loadu_si256((__m256i *) (d1 + i - 1));
+            __m256i diagonal = _mm256_loadu_si256((__m256i *) (d2 + i - 1));
+            __m256i swap_way = _mm256_add_epi32(
+                    _mm256_loadu_si256((__m256i *) (d4 + i - 2)), swap);
+            __m256i rep_penalty = _mm256_blendv_epi8(replace, match,
+                                                     _mm256_cmpeq_epi32(c1, c2));
+            __m256i swappable = _mm256_and_si256(_mm256_cmpeq_epi32(c1, c2_prev),
+                                                 _mm256_cmpeq_epi32(c1_next, c2));
+            __m256i best = _mm256_min_epi32(_mm256_add_epi32(left, shift),
+                                            _mm256_add_epi32(up, shift));
+            best = _mm256_min_epi32(best, _mm256_add_epi32(diagonal, rep_penalty));
+            best = _mm256_blendv_epi8(best, _mm256_min_epi32(best, swap_way), swappable);
+            _mm256_storeu_si256((__m256i *) (cur + i), best);
+        }
+        for (; i <= to; i++)
+            cur[i] = wavefront_cell(radius, i, n1 - d + i, letters1, letters2, d1, d2, d4);
+
+        /* rotate */
+        for (i = 4; i > 0; i--)
+            diagonals[i] = diagonals[i - 1];
+        diagonals[0] = cur;
+    }
+
+    result = diagonals[0][n2];
+    FREE(buffers);
+    FREE(letters1);
+    FREE(letters2);
+    return result;
+}
+
+#endif /* X86_KERNELS */
+
+
+int edit_distance_wavefront(int radius, const char *s1, int n1, const char *s2, int n2)
+{
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return wavefront_avx2(radius, s1, n1, s2, n2);
+#endif
+    return edit_distance_rows(radius, s1, n1, s2, n2);
+}
+
+
+static int compute_edit_distance(int radius, const char *s1, int n1, const char *s2, int n2)
+{
+    if (n1 >= WAVEFRONT_MIN_LENGTH && n2 >= WAVEFRONT_MIN_LENGTH)
+        return edit_distance_wavefront(radius, s1, n1, s2, n2);
+    else
+        return edit_distance_rows(radius, s1, n1, s2, n2);
+}
+
+
+int edit_distance(int radius, const char *s1, int n1, const char *s2, int n2)
+{
+    CacheKey key;
+    int result;
+
+    make_key(&key, radius, s1, n1, s2, n2);
+    if (!cache_lookup(&key, radius, s1, n1, s2, n2, &result))
+    {
+        result = compute_edit_distance(radius, s1, n1, s2, n2);
+        cache_store(&key, radius, s1, n1, s2, n2, result);
+    }
+    return result;
+}
+
+
+/* ______________________________   with a cutoff   __________________________________ */
+
+
+/* Rows up to this length live on the stack. */
+#define MAX_STACK_LENGTH 255
+
+#define INFINITY_PENALTY (0x7FFFFFFF / 2)
+
+
+/* The cheapest way to advance one step along the diagonal. */
+static int diagonal_penalty(int radius)
+{
+    int d = MATCH_PENALTY;
+    if (SWAP_PENALTY / 2 < d) d = SWAP_PENALTY / 2;
+    if (REPLACE_PENALTY < d) d = REPLACE_PENALTY;
+    return d;
+}
+
+
+int edit_distance_lower_bound(int radius, int n1, int n2)
+{
+    int d = diagonal_penalty(radius);
+    int diagonal = n1 < n2 ? n1 : n2;
+    int shifts = n1 < n2 ? n2 - n1 : n1 - n2;
+    return diagonal * d + shifts * SHIFT_PENALTY;
+}
+
+
+/* Matches and swaps don't change the counts of letters.
+ * A shift changes the difference of counts by 1, a replacement - by 2.
+ * Shifts are already paid for the length difference; to cover the rest,
+ * we need replacements or extra pairs of shifts (which take a diagonal step).
+ */
+int edit_distance_lower_bound_by_counts(int radius, int n1, int n2, int mismatched)
+{
+    int d = diagonal_penalty(radius);
+    int shifts = n1 < n2 ? n2 - n1 : n1 - n2;
+    int extra = REPLACE_PENALTY - d;
+    if (2 * SHIFT_PENALTY - d < extra)
+        extra = 2 * SHIFT_PENALTY - d;
+
+    assert(mismatched >= shifts);
+    return edit_distance_lower_bound(radius, n1, n2) + (mismatched - shifts + 1) / 2 * extra;
+}
+
+
+/* This is the same table as in edit_distance(), but:
+ *   - only a band of diagonals is filled: a path that strays too far
+ *     from the diagonal pays too much in shifts;
+ *   - a cell that can't lead to the cutoff (because of the lower bound
+ *     on the rest of the path) is treated as infinity;
+ *   - once two rows in a row are all infinite, we give up
+ *     (swaps can jump over one row, but not over two).
+ * The cells on the optimal path are never touched by all this,
+ * so the result is exact if it's within the cutoff.
+ */
+static int bounded(int radius, const char *s1, int n1, const char *s2, int n2, int cutoff)
+{
+    int stack_table[3 * (MAX_STACK_LENGTH + 1)];
+    int *table;
+    int *row0, *row1, *row2;
+    int d = diagonal_penalty(radius);
+    int delta = n1 - n2;
+    int abs_delta = delta < 0 ? -delta : delta;
+    long budget = (long) cutoff - (long) (n1 < n2 ? n1 : n2) * (d < 0 ? d : 0);
+    long width;
+    int k_min, k_max;
+    int alive_before = 1;
+    int result;
+    int i;
+
+    assert(cutoff < INFINITY_PENALTY);
+
+    if (budget < (long) abs_delta * SHIFT_PENALTY)
+        return cutoff + 1;
+
+    /* The band: j - i (a diagonal) may deviate from 0..delta by `width'. */
+    width = (budget - (long) abs_delta * SHIFT_PENALTY) / (2 * SHIFT_PENALTY);
+    if (width > n1 + n2)
+        width = n1 + n2;
+    k_min = (delta < 0 ? delta : 0) - (int) width;
+    k_max = (delta > 0 ? delta : 0) + (int) width;
+
+    /* If the band is the whole table, the long strings are better done by anti-diagonals */
+    if (k_min <= -n2 && k_max >= n1
+     && n1 >= WAVEFRONT_MIN_LENGTH && n2 >= WAVEFRONT_MIN_LENGTH)
+    {
+        result = edit_distance_wavefront(radius, s1, n1, s2, n2);
+        return result > cutoff ? cutoff + 1 : result;
+    }
+
+    if (n1 <= MAX_STACK_LENGTH)
+        table = stack_table;
+    else
+        table = MALLOC(int, 3 * (n1 + 1));
+    row0 = table;
+    row1 = row0 + n1 + 1;
+    row2 = row1 + n1 + 1;
+
+    /* The band always takes in the corner cell, read at the end;
+     * but the compiler can't see that, so it's defined anyway.
+     */
+    row0[n1] = row1[n1] = row2[n1] = INFINITY_PENALTY;
+
+    for (i = 0; i <= n2; i++)
+    {
+        int j_min = i + k_min < 0 ? 0 : i + k_min;
+        int j_max = i + k_max > n1 ? n1 : i + k_max;
+        int alive = 0;
+        int j;
+        int *tmp;
+
+        /* the neighbours of the band are read by the next rows */
+        if (j_min > 0)
+            row2[j_min - 1] = INFINITY_PENALTY;
+        if (j_max < n1)
+            row2[j_max + 1] = INFINITY_PENALTY;
+
+        for (j = j_min; j <= j_max; j++)
+        {
+            int best;
+            int a = n2 - i, b = n1 - j;
+
+            if (!j)
+                best = i * SHIFT_PENALTY;
+            else
+            {
+                best = row2[j-1] + SHIFT_PENALTY;
+
+                if (i > 0)
+                {
+                    int delete_way = row1[j] + SHIFT_PENALTY;
+                    int rep_penalty = (s1[j-1] == s2[i-1] ? MATCH_PENALTY : REPLACE_PENALTY);
+                    int replace_way = row1[j-1] + rep_penalty;
+
+                    if (delete_way < best)
+                        best = delete_way;
+                    if (replace_way < best)
+                        best = replace_way;
+                }
+
+                if (i > 1 && j > 1 && s1[j-1] == s2[i-2] && s1[j-2] == s2[i-1])
+                {
+                    int swap_way = row0[j-2] + SWAP_PENALTY;
+                    if (swap_way < best)
+                        best = swap_way;
+                }
+            }
+
+            if (best >= INFINITY_PENALTY
+             || best + (a < b ? a : b) * d + (a < b ? b - a : a - b) * SHIFT_PENALTY > cutoff)
+            {
+                best = INFINITY_PENALTY;
+            }
+            else
+                alive = 1;
+
+            row2[j] = best;
+        }
+
+        if (!alive && !alive_before)
+        {
+            if (table != stack_table)
+                FREE(table);
+            return cutoff + 1;
+        }
+        alive_before = alive;
+
+        /* rotate: row2 into row1, etc */
+        tmp = row0;
+        row0 = row1;
+        row1 = row2;
+        row2 = tmp;
+    }
+
+    result = row1[n1];
+    if (table != stack_table)
+        FREE(table);
+    return result > cutoff ? cutoff + 1 : result;
+}
+
+
+int edit_distance_bounded(int radius, const char *s1, int n1, const char *s2, int n2,
+                          int cutoff)
+{
+    CacheKey key;
+    int result;
+
+    make_key(&key, radius, s1, n1, s2, n2);
+    if (cache_lookup(&key, radius, s1, n1, s2, n2, &result))
+        return result > cutoff ? cutoff + 1 : result;
+
+    result = bounded(radius, s1, n1, s2, n2, cutoff);
+    if (result <= cutoff)   /* then it's exact */
+        cache_store(&key, radius, s1, n1, s2, n2, result);
+    return result;
+}
+
+
+/* ______________________________   column by column   __________________________________ */
+
+
+int edit_distance_column(int radius, const char *s2, int n2, int j,
+                         const int *prev2, const int *prev, char c0, char c1, int *column)
+{
+    int d = diagonal_penalty(radius);
+    int bound;
+    int i;
+
+    if (d > 0)
+        d = 0;
+
+    column[0] = j * SHIFT_PENALTY;
+    bound = column[0] + n2 * d;
+    if (!j)
+    {
+        for (i = 1; i <= n2; i++)
+            column[i] = i * SHIFT_PENALTY;
+        return bound;
+    }
+
+    for (i = 1; i <= n2; i++)
+    {
+        int best = prev[i] + SHIFT_PENALTY;
+        int delete_way = column[i-1] + SHIFT_PENALTY;
+        int replace_way = prev[i-1] + (c1 == s2[i-1] ? MATCH_PENALTY : REPLACE_PENALTY);
+
+        if (delete_way < best)
+            best = delete_way;
+        if (replace_way < best)
+            best = replace_way;
+
+        if (i > 1 && j > 1 && c1 == s2[i-2] && c0 == s2[i-1])
+        {
+            int swap_way = prev2[i-2] + SWAP_PENALTY;
+            if (swap_way < best)
+                best = swap_way;
+        }
+
+        column[i] = best;
+        if (best + (n2 - i) * d < bound)
+            bound = best + (n2 - i) * d;
+    }
+
+    return bound;
+}
+
+
+/* ______________________________   one against many   __________________________________ */
+
+
+/* The SIMD kernels below follow the SWIPE idea: each lane of a vector
+ * holds a cell of its own table, one for each string. All the tables
+ * are filled in lockstep, row by row along the query, and each lane
+ * picks its result at its own column in the last row.
+ * The cells are 16-bit, so we only go there if the values surely fit.
+ */
+
+#define MAX_LANES 16
+
+
+static void distances_generic(int radius, const char *query, int n2,
+                              int count, const char **strings, const int *lengths,
+                              int *result)
+{
+    int k;
+    for (k = 0; k < count; k++)
+        result[k] = edit_distance(radius, strings[k], lengths[k], query, n2);
+}
+
+
+#ifdef X86_KERNELS
+
+static int fits_in_16_bits(int radius, int max_length, int n2)
+{
+    long biggest = SHIFT_PENALTY;
+    if (REPLACE_PENALTY > biggest) biggest = REPLACE_PENALTY;
+    if (SWAP_PENALTY > biggest) biggest = SWAP_PENALTY;
+    if (radius > biggest) biggest = radius;
+    if (-radius > biggest) biggest = -radius;
+    return (long) (max_length + n2 + 2) * biggest < 32000;
+}
+
+
+/* Interleave the letters: columns[j * lanes + k] is the j-th letter of the k-th string.
+ * Strings shorter than the longest one are padded with NO_LETTER.
+ */
+static void pack_columns(int lanes, int count, const char **strings, const int *lengths,
+                         int max_length, short *columns)
+{
+    int j, k;
+    for (j = 0; j < max_length; j++)
+        for (k = 0; k < lanes; k++)
+        {
+            columns[j * lanes + k] = k < count && j < lengths[k]
+                                   ? (unsigned char) strings[k][j] : NO_LETTER;
+        }
+}
+
+
+__attribute__((target("sse2")))
+static void distances_sse2(int radius, const char *query, int n2,
+                           int count, const char **strings, const int *lengths,
+                           int max_length, short *columns, short *table, int *result)
+{
+    __m128i shift = _mm_set1_epi16(SHIFT_PENALTY);
+    __m128i match = _mm_set1_epi16(MATCH_PENALTY);
+    __m128i replace = _mm_set1_epi16(REPLACE_PENALTY);
+    __m128i swap = _mm_set1_epi16(SWAP_PENALTY);
+    short *row0 = table;
+    short *row1 = row0 + 8 * (max_length + 1);
+    short *row2 = row1 + 8 * (max_length + 1);
+    int i, j, k;
+
+    pack_columns(8, count, strings, lengths, max_length, columns);
+
+    for (i = 0; i <= n2; i++)
+    {
+        __m128i left = _mm_set1_epi16(i * SHIFT_PENALTY);
+        __m128i letter = _mm_set1_epi16(i > 0 ? (unsigned char) query[i-1] : NO_LETTER);
+        __m128i prev_letter = _mm_set1_epi16(i > 1 ? (unsigned char) query[i-2] : NO_LETTER);
+        __m128i prev_column = _mm_set1_epi16(NO_LETTER);
+        short *tmp;
+
+        _mm_storeu_si128((__m128i *) row2, left);
+        for (j = 1; j <= max_length; j++)
+        {
+            __m128i column = _mm_loadu_si128((__m128i *) (columns + 8 * (j-1)));
+            __m128i best = _mm_add_epi16(left, shift);
+
+            if (i > 0)
+            {
+                __m128i up = _mm_loadu_si128((__m128i *) (row1 + 8 * j));
+                __m128i diagonal = _mm_loadu_si128((__m128i *) (row1 + 8 * (j-1)));
+                __m128i equal = _mm_cmpeq_epi16(column, letter);
+                __m128i rep_penalty = _mm_or_si128(_mm_and_si128(equal, match),
+                                                   _mm_andnot_si128(equal, replace));
+                best = _mm_min_epi16(best, _mm_add_epi16(up, shift));
+                best = _mm_min_epi16(best, _mm_add_epi16(diagonal, rep_penalty));
+            }
+
+            if (i > 1 && j > 1)
+            {
+                __m128i swappable = _mm_and_si128(_mm_cmpeq_epi16(column, prev_letter),
+                                                  _mm_cmpeq_epi16(prev_column, letter));
+                __m128i swap_way = _mm_add_epi16(
+                        _mm_loadu_si128((__m128i *) (row0 + 8 * (j-2))), swap);
+                best = _mm_or_si128(_mm_and_si128(swappable, _mm_min_epi16(best, swap_way)),
+                                    _mm_andnot_si128(swappable, best));
+            }
+
+            _mm_storeu_si128((__m128i *) (row2 + 8 * j), best);
+            left = best;
+            prev_column = column;
+        }
+
+        /* rotate: row2 into row1, etc */
+        tmp = row0;
+        row0 = row1;
+        row1 = row2;
+        row2 = tmp;
+    }
+
+    for (k = 0; k < count; k++)
+        result[k] = row1[8 * lengths[k] + k];
+}
+
+
+__attribute__((target("avx2")))
+static void distances_avx2(int radius, const char *query, int n2,
+                           int count, const char **strings, const int *lengths,
+                           int max_length, short *columns, short *table, int *result)
+{
+    __m256i shift = _mm256_set1_epi16(SHIFT_PENALTY);
+    __m256i match = _mm256_set1_epi16(MATCH_PENALTY);
+    __m256i replace = _mm256_set1_epi16(REPLACE_PENALTY);
+    __m256i swap = _mm256_set1_epi16(SWAP_PENALTY);
+    short *row0 = table;
+    short *row1 = row0 + 16 * (max_length + 1);
+    short *row2 = row1 + 16 * (max_length + 1);
+    int i, j, k;
+
+    pack_columns(16, count, strings, lengths, max_length, columns);
+
+    for (i = 0; i <= n2; i++)
+    {
+        __m256i left = _mm256_set1_epi16(i * SHIFT_PENALTY);
+        __m256i letter = _mm256_set1_epi16(i > 0 ? (unsigned char) query[i-1] : NO_LETTER);
+        __m256i prev_letter = _mm256_set1_epi16(i > 1 ? (unsigned char) query[i-2] : NO_LETTER);
+        __m256i prev_column = _mm256_set1_epi16(NO_LETTER);
+        short *tmp;
+
+        _mm256_storeu_si256((__m256i *) row2, left);
+        for (j = 1; j <= max_length; j++)
+        {
+            __m256i column = _mm256_loadu_si256((__m256i *) (columns + 16 * (j-1)));
+            __m256i best = _mm256_add_epi16(left, shift);
+
+            if (i > 0)
+            {
+                __m256i up = _mm256_loadu_si256((__m256i *) (row1 + 16 * j));
+                __m256i diagonal = _mm256_loadu_si256((__m256i *) (row1 + 16 * (j-1)));
+                __m256i equal = _mm256_cmpeq_epi16(column, letter);
+                __m256i rep_penalty = _mm256_blendv_epi8(replace, match, equal);
+                best = _mm256_min_epi16(best, _mm256_add_epi16(up, shift));
+                best = _mm256_min_epi16(best, _mm256_add_epi16(diagonal, rep_penalty));
+            }
+
+            if (i > 1 && j > 1)
+            {
+                __m256i swappable = _mm256_and_si256(_mm256_cmpeq_epi16(column, prev_letter),
+                                                     _mm256_cmpeq_epi16(prev_column, letter));
+                __m256i swap_way = _mm256_add_epi16(
+                        _mm256_loadu_si256((__m256i *) (row0 + 16 * (j-2))), swap);
+                best = _mm256_blendv_epi8(best, _mm256_min_epi16(best, swap_way), swappable);
+            }
+
+            _mm256_storeu_si256((__m256i *) (row2 + 16 * j), best);
+            left = best;
+            prev_column = column;
+        }
+
+        /* rotate: row2 into row1, etc */
+        tmp = row0;
+        row0 = row1;
+        row1 = row2;
+        row2 = tmp;
+    }
+
+    for (k = 0; k < count; k++)
+        result[k] = row1[16 * lengths[k] + k];
+}
+
+#endif /* X86_KERNELS */
+
+
+int edit_distances_lanes(void)
+{
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return 16;
+    if (__builtin_cpu_supports("sse2"))
+        return 8;
+#endif
+    return 1;
+}
+
+
+static void compute_edit_distances(int radius, const char *query, int query_length,
+                                   int count, const char **strings, const int *lengths,
+                                   int *result)
+{
+#ifdef X86_KERNELS
+    int max_length = 0;
+    int k;
+
+    for (k = 0; k < count; k++)
+        if (lengths[k] > max_length)
+            max_length = lengths[k];
+
+    __builtin_cpu_init();
+    if (count > 1 && fits_in_16_bits(radius, max_length, query_length)
+     && __builtin_cpu_supports("sse2"))
+    {
+        int avx2 = __builtin_cpu_supports("avx2");
+        int lanes = avx2 ? 16 : 8;
+        short *columns = MALLOC(short, lanes * max_length + 1);
+        short *table = MALLOC(short, 3 * lanes * (max_length + 1));
+
+        for (k = 0; k < count; k += lanes)
+        {
+            int n = count - k < lanes ? count - k : lanes;
+            int group_length = 0;
+            int l;
+
+            /* the tables only need to be as wide as the longest string here */
+            for (l = 0; l < n; l++)
+                if (lengths[k + l] > group_length)
+                    group_length = lengths[k + l];
+
+            if (avx2)
+                distances_avx2(radius, query, query_length, n, strings + k, lengths + k,
+                               group_length, columns, table, result + k);
+            else
+                distances_sse2(radius, query, query_length, n, strings + k, lengths + k,
+                               group_length, columns, table, result + k);
+        }
+
+        FREE(columns);
+        FREE(table);
+        return;
+    }
+#endif
+    distances_generic(radius, query, query_length, count, strings, lengths, result);
+}
+
+
+/* Only the misses go to the SIMD kernel. */
+void edit_distances(int radius, const char *query, int query_length,
+                    int count, const char **strings, const int *lengths, int *result)
+{
+    CacheKey *keys;
+    const char **missed_strings;
+    int *missed_lengths, *missed_results, *missed;
+    int misses = 0;
+    int k;
+
+    if (!cache_size)
+    {
+        compute_edit_distances(radius, query, query_length, count, strings, lengths, result);
+        return;
+    }
+
+    keys = MALLOC(CacheKey, count);
+    missed_strings = MALLOC(const char *, count);
+    missed_lengths = MALLOC(int, count);
+    missed_results = MALLOC(int, count);
+    missed = MALLOC(int, count);
+
+    for (k = 0; k < count; k++)
+    {
+        make_key(&keys[k], radius, strings[k], lengths[k], query, query_length);
+        if (!cache_lookup(&keys[k], radius, strings[k], lengths[k], query, query_length,
+                          &result[k]))
+        {
+            missed_strings[misses] = strings[k];
+            missed_lengths[misses] = lengths[k];
+            missed[misses] = k;
+            misses++;
+        }
+    }
+
+    if (misses)
+    {
+        compute_edit_distances(radius, query, query_length,
+                               misses, missed_strings, missed_lengths, missed_results);
+        for (k = 0; k < misses; k++)
+        {
+            int i = missed[k];
+            result[i] = missed_results[k];
+            cache_store(&keys[i], radius, strings[i], lengths[i], query, query_length,
+                        result[i]);
+        }
+    }
+
+    FREE(keys);
+    FREE(missed_strings);
+    FREE(missed_lengths);
+    FREE(missed_results);
+    FREE(missed);
+}
+
+
+/* ______________________________   the queue   __________________________________ */
+
+
+#define QUEUE_SIZE (4 * MAX_LANES)
+
+
+struct EditDistanceQueueStruct
+{
+    int radius;
+    const char *query;
+    int query_length;
+    int count;
+    const char *strings[QUEUE_SIZE];
+    int lengths[QUEUE_SIZE];
+    int *destinations[QUEUE_SIZE];
+};
+
+
+EditDistanceQueue create_edit_distance_queue(int radius, const char *query, int query_length)
+{
+    EditDistanceQueue q = MALLOC1(struct EditDistanceQueueStruct);
+    q->radius = radius;
+    q->query = query;
+    q->query_length = query_length;
+    q->count = 0;
+    return q;
+}
+
+
+void edit_distance_queue_flush(EditDistanceQueue q)
+{
+    int results[QUEUE_SIZE];
+    int k;
+
+    if (!q->count)
+        return;
+
+    edit_distances(q->radius, q->query, q->query_length,
+                   q->count, q->strings, q->lengths, results);
+    for (k = 0; k < q->count; k++)
+        *q->destinations[k] = results[k];
+    q->count = 0;
+}
+
+
+void edit_distance_queue_push(EditDistanceQueue q, const char *s, int n, int *result)
+{
+    if (q->count == QUEUE_SIZE)
+        edit_distance_queue_flush(q);
+    q->strings[q->count] = s;
+    q->lengths[q->count] = n;
+    q->destinations[q->count] = result;
+    q->count++;
+}
+
+
+void free_edit_distance_queue(EditDistanceQueue q)
+{
+    edit_distance_queue_flush(q);
+    FREE1(q);
+}
+
+
+#ifdef TESTING
+
+static void ed(int radius, const char *s1, const char *s2, int result)
+{
+    int n1 = strlen(s1);
+    int n2 = strlen(s2);
+    assert(edit_distance(radius, s1, n1, s2, n2) == result);
+    assert(edit_distance(radius, s2, n2, s1, n1) == result);
+}
+
+static void test_ed(void)
+{
+    /* TODO: better tests */
+    int radius = 100;
+    ed(radius, "a", "b", REPLACE_PENALTY);
+    ed(radius, "ab", "ab", 2*MATCH_PENALTY);
+    ed(radius, "a", "ab", MATCH_PENALTY + SHIFT_PENALTY);
+    ed(radius, "aba", "aab", MATCH_PENALTY + SWAP_PENALTY);
+}
+
+static int count_mismatch(const char *s1, int n1, const char *s2, int n2)
+{
+    int counts[256];
+    int i, result = 0;
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < n1; i++) counts[(unsigned char) s1[i]]++;
+    for (i = 0; i < n2; i++) counts[(unsigned char) s2[i]]--;
+    for (i = 0; i < 256; i++) result += counts[i] < 0 ? -counts[i] : counts[i];
+    return result;
+}
+
+/* Compare with the plain edit_distance() on random strings of few letters. */
+static void test_bounded(void)
+{
+    char s1[40], s2[40];
+    int t;
+
+    srand(11);
+    for (t = 0; t < 3000; t++)
+    {
+        int n1 = rand() % 40, n2 = rand() % 40;
+        int radius = rand() % 100;
+        int i, exact, cutoff;
+
+        for (i = 0; i < n1; i++) s1[i] = '1' + rand() % 3;
+        for (i = 0; i < n2; i++) s2[i] = '1' + rand() % 3;
+        exact = edit_distance(radius, s1, n1, s2, n2);
+        assert(exact >= edit_distance_lower_bound(radius, n1, n2));
+        assert(exact >= edit_distance_lower_bound_by_counts(radius, n1, n2,
+                                                            count_mismatch(s1, n1, s2, n2)));
+
+        cutoff = exact + rand() % 300 - 150;
+        if (exact <= cutoff)
+            assert(edit_distance_bounded(radius, s1, n1, s2, n2, cutoff) == exact);
+        else
+            assert(edit_distance_bounded(radius, s1, n1, s2, n2, cutoff) == cutoff + 1);
+        assert(edit_distance_bounded(radius, s1, n1, s2, n2, NO_CUTOFF) == exact);
+    }
+}
+
+typedef void (*BatchKernel)(int, const char *, int, int, const char **, const int *,
+                            int, short *, short *, int *);
+
+static void check_batch(BatchKernel kernel, int lanes)
+{
+    char strings[MAX_LANES][60];
+    const char *pointers[MAX_LANES];
+    int lengths[MAX_LANES], expected[MAX_LANES], actual[MAX_LANES];
+    short *columns = MALLOC(short, lanes * 60);
+    short *table = MALLOC(short, 3 * lanes * 61);
+    char query[60];
+    int t, i, k;
+
+    srand(13);
+    for (t = 0; t < 200; t++)
+    {
+        int n2 = rand() % 60;
+        int count = 1 + rand() % lanes;
+        int radius = rand() % 100;
+        int max_length = 0;
+
+        for (i = 0; i < n2; i++) query[i] = '1' + rand() % 3;
+        for (k = 0; k < count; k++)
+        {
+            lengths[k] = rand() % 60;
+            for (i = 0; i < lengths[k]; i++) strings[k][i] = '1' + rand() % 3;
+            pointers[k] = strings[k];
+            if (lengths[k] > max_length) max_length = lengths[k];
+        }
+
+        distances_generic(radius, query, n2, count, pointers, lengths, expected);
+        if (kernel)
+            kernel(radius, query, n2, count, pointers, lengths, max_length, columns, table, actual);
+        else
+            edit_distances(radius, query, n2, count, pointers, lengths, actual);
+        for (k = 0; k < count; k++)
+            assert(actual[k] == expected[k]);
+    }
+
+    FREE(columns);
+    FREE(table);
+}
+
+static void test_batch(void)
+{
+    check_batch(NULL, MAX_LANES);
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        check_batch(distances_sse2, 8);
+    if (__builtin_cpu_supports("avx2"))
+        check_batch(distances_avx2, 16);
+#endif
+}
+
+static void test_wavefront(void)
+{
+    char s1[300], s2[300];
+    int t, i;
+
+    srand(17);
+    for (t = 0; t < 300; t++)
+    {
+        int n1 = t < 20 ? t : rand() % 300;
+        int n2 = t < 20 ? 19 - t : rand() % 300;
+        int radius = rand() % 100;
+
+        for (i = 0; i < n1; i++) s1[i] = '1' + rand() % 3;
+        for (i = 0; i < n2; i++) s2[i] = '1' + rand() % 3;
+        assert(edit_distance_wavefront(radius, s1, n1, s2, n2)
+            == edit_distance_rows(radius, s1, n1, s2, n2));
+    }
+}
+
+/* A thread that gets a miss and a hit, then exits with its cache. */
+static void *cache_thread(void *data)
+{
+    int d = edit_distance(50, "2266", 4, "2662", 4);
+    assert(edit_distance(50, "2266", 4, "2662", 4) == d);
+    return data;
+}
+
+static void test_cache(void)
+{
+    const char *strings[2] = {"2266", "26"};
+    int lengths[2] = {4, 2};
+    int batch[2];
+    long hits, misses, hits0, misses0;
+    pthread_t thread;
+    int d;
+
+    set_edit_distance_cache_size(16);
+    get_edit_distance_cache_stats(&hits0, &misses0);
+    d = edit_distance(50, "2266", 4, "2662", 4);
+    assert(edit_distance(50, "2266", 4, "2662", 4) == d);
+    assert(edit_distance_bounded(50, "2266", 4, "2662", 4, d - 1) == d);
+    assert(edit_distance(40, "2266", 4, "2662", 4) != d);     /* another radius */
+    get_edit_distance_cache_stats(&hits, &misses);
+    assert(hits - hits0 == 2 && misses - misses0 == 2);
+
+    /* a batch that hits all the way */
+    edit_distances(50, "2662", 4, 2, strings, lengths, batch);
+    assert(batch[0] == d);
+    get_edit_distance_cache_stats(&hits, &misses);
+    edit_distances(50, "2662", 4, 2, strings, lengths, batch);
+    assert(batch[0] == d);
+    get_edit_distance_cache_stats(&hits0, &misses0);
+    assert(hits0 - hits == 2 && misses0 == misses);
+
+    /* the counts of a finished thread still count */
+    pthread_create(&thread, NULL, cache_thread, NULL);
+    pthread_join(thread, NULL);
+    get_edit_distance_cache_stats(&hits, &misses);
+    assert(hits - hits0 == 1 && misses - misses0 == 1);
+
+    set_edit_distance_cache_size(0);
+    assert(edit_distance(50, "2266", 4, "2662", 4) == d);
+    get_edit_distance_cache_stats(&hits0, &misses0);
+    assert(hits0 == hits && misses0 == misses);
+
+    set_edit_distance_cache_size(DEFAULT_CACHE_SIZE);
+}
+
+static TestFunction tests[] = {
+    test_cache,
+    test_wavefront,
+    test_batch,
+    test_ed,
+    test_bounded,
+    NULL
+};
+
+TestSuite editdist_suite = {"editdist", NULL, NULL, tests};
+
+
+#endif
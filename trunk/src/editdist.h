@@ -1,11 +1,73 @@
-#ifndef PLASMA_OCR_EDITDIST_H
-#define PLASMA_OCR_EDITDIST_H
-
-
-int edit_distance(int radius, const char *s1, int n1, const char *s2, int n2);
-
-#ifdef TESTING
-extern TestSuite editdist_suite;
-#endif
-
-#endif
+#ifndef PLASMA_OCR_EDITDIST_H
+#define PLASMA_OCR_EDITDIST_H
+
+
+int edit_distance(int radius, const char *s1, int n1, const char *s2, int n2);
+
+/* The two ways to compute the same thing; edit_distance() chooses by length.
+ * The anti-diagonal one needs AVX2 (otherwise it just calls the other one).
+ */
+int edit_distance_rows(int radius, const char *s1, int n1, const char *s2, int n2);
+int edit_distance_wavefront(int radius, const char *s1, int n1, const char *s2, int n2);
+
+/* A cutoff that's never reached. */
+#define NO_CUTOFF 0x1FFFFFFF
+
+/* Same as edit_distance() if the result is <= `cutoff',
+ * otherwise returns cutoff + 1 (doing much less work).
+ * Doesn't allocate memory unless s1 is very long.
+ */
+int edit_distance_bounded(int radius, const char *s1, int n1, const char *s2, int n2,
+                          int cutoff);
+
+/* The distance between any strings of lengths n1 and n2 is at least that. */
+int edit_distance_lower_bound(int radius, int n1, int n2);
+
+/* A better lower bound given the letter counts of the strings:
+ * `mismatched' is the sum over all letters of |count in s1 - count in s2|.
+ */
+int edit_distance_lower_bound_by_counts(int radius, int n1, int n2, int mismatched);
+
+/* The table of edit_distance(radius, s1, n1, s2, n2) column by column,
+ * for walking over many s1's sharing prefixes (see ropetrie.h).
+ * Computes the column j (n2 + 1 cells) from the two previous ones
+ * (unused when j < 2); c1 = s1[j-1] and c0 = s1[j-2].
+ * Returns a lower bound on the distance between s2 and
+ * anything starting with s1[0..j-1].
+ */
+int edit_distance_column(int radius, const char *s2, int n2, int j,
+                         const int *prev2, const int *prev, char c0, char c1, int *column);
+
+/* result[k] = edit_distance(radius, strings[k], lengths[k], query, query_length)
+ * for all k < count. Uses SIMD to do many strings at once.
+ */
+void edit_distances(int radius, const char *query, int query_length,
+                    int count, const char **strings, const int *lengths, int *result);
+
+/* How many strings edit_distances() does at once (1 if there's no SIMD). */
+int edit_distances_lanes(void);
+
+/* A queue of strings to compare against the same query.
+ * The distances are computed in batches by edit_distances()
+ * and written to the given places when the queue is flushed (or gets full).
+ * Freeing the queue flushes it.
+ */
+typedef struct EditDistanceQueueStruct *EditDistanceQueue;
+
+EditDistanceQueue create_edit_distance_queue(int radius, const char *query, int query_length);
+void edit_distance_queue_push(EditDistanceQueue, const char *s, int n, int *result);
+void edit_distance_queue_flush(EditDistanceQueue);
+void free_edit_distance_queue(EditDistanceQueue);
+
+/* Distances between pairs of (short) strings are cached.
+ * The size is in entries (rounded down to a power of 2); 0 turns the cache off.
+ * Should be set before any distances are computed.
+ */
+void set_edit_distance_cache_size(int entries);
+void get_edit_distance_cache_stats(long *hits, long *misses);
+
+#ifdef TESTING
+extern TestSuite editdist_suite;
+#endif
+
+#endif
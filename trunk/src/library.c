@@ -1,6 +1,7 @@
 #include "common.h"
 #include "library.h"
 #include "io.h"
+#include "stats.h"
 #include "bitmaps.h"
 #include "rle.h"
 #include <assert.h>
@@ -12,50 +13,36 @@ void library_iterator_init(LibraryIterator *li, int n, Library *libs)
     li->libraries = libs;
     li->current_library_index = 0;
     li->current_shelf_index = 0;
-
-    if (n && library_shelves_count(*libs))
-        li->current_shelf = library_get_shelf(*libs, 0);
-    else
-        li->current_shelf = NULL;
-
+    li->current_shelf = NULL;
     li->current_record_index = 0;
 }
 
+/* Empty shelves and libraries are skipped. */
 LibraryRecord *library_iterator_next(LibraryIterator *li)
 {
-    Library l;
-    LibraryRecord *result;
-    if (li->current_library_index >= li->libraries_count)
-        return NULL;
-    
-    assert(li->current_library_index >= 0);
-    result = &li->current_shelf->records[li->current_record_index];
-    
-    l = li->libraries[li->current_library_index];
-
-    li->current_record_index++;
-    if (li->current_record_index == li->current_shelf->count)
+    while (li->current_library_index < li->libraries_count)
     {
-        /* change shelf */
-        li->current_record_index = 0;
-        li->current_shelf_index++;
+        Library l = li->libraries[li->current_library_index];
+        assert(li->current_library_index >= 0);
+
         if (li->current_shelf_index == library_shelves_count(l))
         {
             /* change library */
             li->current_library_index++;
-            l = li->libraries[li->current_library_index];
             li->current_shelf_index = 0;
-            if (li->current_library_index == li->libraries_count)
-            {
-                /* finish */
-                li->current_library_index = li->libraries_count;
-                return result;
-            }
+            continue;
         }
-        li->current_shelf = library_get_shelf
-                                (l, li->current_shelf_index);
+
+        li->current_shelf = library_get_shelf(l, li->current_shelf_index);
+        if (li->current_record_index < li->current_shelf->count)
+            return &li->current_shelf->records[li->current_record_index++];
+
+        /* change shelf */
+        li->current_record_index = 0;
+        li->current_shelf_index++;
     }
-    return result;
+
+    return NULL;
 }
 
 
@@ -149,6 +136,7 @@ static int load_shelf(Library l, FILE *f)
     
     s->allocated = s->count = count;
     s->pixels = NULL;
+    s->ownership = 0;
     s->records = MALLOC(LibraryRecord, s->count);
     
     for (i = 0; i < s->count; i++)
@@ -201,6 +189,7 @@ static int load_shelf_recreating(Library l, FILE *f)
     s->records = MALLOC(LibraryRecord, s->count);
 
     rle_decode_FILE(f, &s->pixels, &s->width, &s->height);
+    s->ownership = 1;
     pc = create_pattern_cache(s->pixels, s->width, s->height);
 
     load_rectangles(s, f);
@@ -311,8 +300,7 @@ Library library_open(const char *path)
     FILE *f = checked_fopen(path, "rb");
     
     l->file = f;
-    while (1)
-        if (!load_shelf(l, f)) break;
+    STATS_TIME(STAT_LIBRARY_LOAD, while (load_shelf(l, f)) {});
     
     return l;
 }
@@ -322,8 +310,7 @@ Library library_open_recreating(const char *path)
     FILE *f = checked_fopen(path, "rb");
     
     l->file = NULL;
-    while (1)
-        if (!load_shelf_recreating(l, f)) break;
+    STATS_TIME(STAT_LIBRARY_LOAD, while (load_shelf_recreating(l, f)) {});
     
     checked_fclose(f);
     
@@ -407,3 +394,13 @@ Shelf *library_get_shelf(Library l, int i)
 {
     return &l->shelves[i];
 }
+
+
+void library_take_shelves(Library dst, Library src)
+{
+    int i;
+    assert(dst != src);
+    for (i = 0; i < src->count; i++)
+        *library_append_shelf(dst) = src->shelves[i];
+    src->count = 0;
+}
@@ -43,6 +43,11 @@ void library_save(Library, const char *path, int append);
 int library_shelves_count(Library);
 Shelf *library_get_shelf(Library, int i);
 
+/* Move all shelves of `src' to the end of `dst', leaving `src' empty.
+ * Pointers to the moved shelves become invalid.
+ */
+void library_take_shelves(Library dst, Library src);
+
 
 typedef struct
 {
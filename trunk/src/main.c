@@ -7,9 +7,14 @@ exit
 #include "common.h"
 #include "core.h"
 #include "bitmaps.h"
+#include "thinning.h"
 #include "pnm.h"
+#include "cluster.h"
+#include "editdist.h"
+#include "stats.h"
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
 
 
 #define TAG_BEGIN  '$'
@@ -26,6 +31,42 @@ static void usage(void)
 }
 
 
+typedef enum
+{
+    ITEM_TEXT,
+    ITEM_WORD,
+    ITEM_LETTER
+} JobItemType;
+
+
+/* A piece of the job file: either a verbatim text or a rectangle to recognize.
+ * Used in the multithreaded mode, where the whole job file is parsed first.
+ */
+typedef struct
+{
+    JobItemType type;
+    char *text;                 /* ITEM_TEXT only */
+    int length, allocated;
+    int x, y, w, h;             /* the rest is for ITEM_WORD and ITEM_LETTER */
+    int done;
+    RecognizedWord *word;
+    RecognizedLetter *letter;
+    Library orange;             /* what the worker has collected, or NULL */
+    int representative;         /* the item of the same cluster, or -1 */
+    int shared;                 /* other items may print our results */
+} JobItem;
+
+
+typedef struct
+{
+    int count, allocated;
+    JobItem *items;
+    int next_item;              /* the next item for a worker to take */
+    pthread_mutex_t mutex;
+    pthread_cond_t item_done;
+} JobQueue;
+
+
 typedef struct
 {
     char *input_path;
@@ -35,12 +76,33 @@ typedef struct
     int just_one_letter;
     int just_one_word;
     int append;
+    int threads;
+    long cluster_threshold;     /* -1 if we don't cluster glyphs */
     Core core;
+    JobQueue *queue;            /* NULL in the serial mode */
     unsigned char **pixels;
     int width, height;
+    int page_skeleton;          /* skeletonize the page at once, not word by word */
+    unsigned char **skeleton;   /* of the page, or NULL */
     char *ground_truth;
+    int print_stats;
+    char *json_stats_path;
 } Job;
 
+
+/* Workers share the core, but each one has its own recognition context. */
+typedef struct
+{
+    Job *job;
+    RecognitionContext context;
+    pthread_t thread;
+} Worker;
+
+
+static JobItem *append_job_item(JobQueue *q)
+    LIST_APPEND(JobItem, q->items, q->count, q->allocated)
+
+
 static void init_job(Job *job)
 {
     job->input_path = NULL;
@@ -48,9 +110,16 @@ static void init_job(Job *job)
     job->out_library_path = NULL;
     job->colored_output = isatty(1);
     job->pixels = NULL;
+    job->page_skeleton = 0;
+    job->skeleton = NULL;
     job->just_one_word = job->just_one_letter = 0;
     job->ground_truth = NULL;
     job->append = 0;
+    job->threads = 1;
+    job->cluster_threshold = -1;
+    job->print_stats = 0;
+    job->json_stats_path = NULL;
+    job->queue = NULL;
 }
 
 static void load_image(Job *job)
@@ -86,19 +155,22 @@ static void color_print_recognized_letter(RecognizedLetter *l)
     }
 }
 
-static void process_word(Job *job, int x, int y, int w, int h)
+static int rectangle_is_valid(Job *job, int x, int y, int w, int h)
 {
-    unsigned char **window;
-    RecognizedWord *rw;
+    return !(x < 0 || x + w > job->width || y < 0 || y + h > job->height);
+}
 
-    if (x < 0 || x + w > job->width || y < 0 || y + h > job->height)
+static void check_rectangle(Job *job, int x, int y, int w, int h)
+{
+    if (!rectangle_is_valid(job, x, y, w, h))
     {
         fprintf(stderr, "invalid rectangle coordinates\n");
         exit(1);
     }
-    
-    window = subbitmap(job->pixels, x, y, h);
-    rw = recognize_word(job->core, window, w, h, 0);
+}
+
+static void print_recognized_word(Job *job, RecognizedWord *rw)
+{
     if (job->colored_output)
     {
         int i;
@@ -107,34 +179,350 @@ static void process_word(Job *job, int x, int y, int w, int h)
     }
     else
         fputs(rw->text, stdout);
+}
+
+static void print_recognized_letter(Job *job, RecognizedLetter *rl)
+{
+    if (job->colored_output)
+        color_print_recognized_letter(rl);
+    else if (rl->text)
+        fputs(rl->text, stdout);
+    else
+        putchar('_');
+}
+
+/* The window of the page skeleton for a word rectangle,
+ * or NULL if the word has to be thinned by itself
+ * (that's when a glyph sticks out of the rectangle, it's thinned differently).
+ */
+static unsigned char **skeleton_window(Job *job, int x, int y, int w, int h)
+{
+    if (!job->skeleton
+     || !window_is_isolated(job->pixels, job->width, job->height, x, y, w, h))
+        return NULL;
+    return subbitmap(job->skeleton, x, y, h);
+}
+
+static void process_word(Job *job, int x, int y, int w, int h)
+{
+    unsigned char **window;
+    unsigned char **skeleton;
+    RecognizedWord *rw;
+
+    check_rectangle(job, x, y, w, h);
+    
+    window = subbitmap(job->pixels, x, y, h);
+    skeleton = skeleton_window(job, x, y, w, h);
+    rw = recognize_word_in_skeleton(get_core_context(job->core),
+                                    window, skeleton, w, h, 0);
+    print_recognized_word(job, rw);
     
     free_recognized_word(rw);
     FREE(window);
+    if (skeleton)
+        FREE(skeleton);
 }
 
 static void process_letter(Job *job, int x, int y, int w, int h)
 {
     unsigned char **window;
     RecognizedLetter *rl;
-    if (x < 0 || x + w > job->width || y < 0 || y + h > job->height)
-    {
-        fprintf(stderr, "invalid rectangle coordinates\n");
-        exit(1);
-    }
+
+    check_rectangle(job, x, y, w, h);
 
     window = subbitmap(job->pixels, x, y, h);
     rl = recognize_letter(job->core, window, w, h, 0);
-    if (job->colored_output)
-        color_print_recognized_letter(rl);
-    else if (rl->text)
-        fputs(rl->text, stdout);
-    else
-        putchar('_');
+    print_recognized_letter(job, rl);
 
     free_recognized_letter(rl);
     FREE(window);
 }
 
+
+/* ____________________________   job queue   ____________________________ */
+
+
+static JobQueue *create_job_queue(void)
+{
+    JobQueue *q = MALLOC1(JobQueue);
+    LIST_CREATE(JobItem, q->items, q->count, q->allocated, 64);
+    q->next_item = 0;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->item_done, NULL);
+    return q;
+}
+
+static void destroy_job_queue(JobQueue *q)
+{
+    int i;
+    for (i = 0; i < q->count; i++)
+    {
+        if (q->items[i].type == ITEM_TEXT)
+            FREE(q->items[i].text);
+    }
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->item_done);
+    FREE(q->items);
+    FREE1(q);
+}
+
+static void queue_char(JobQueue *q, int c)
+{
+    JobItem *item = q->count ? &q->items[q->count - 1] : NULL;
+    if (!item || item->type != ITEM_TEXT)
+    {
+        item = append_job_item(q);
+        item->type = ITEM_TEXT;
+        LIST_CREATE(char, item->text, item->length, item->allocated, 64);
+    }
+
+    if (item->length == item->allocated)
+    {
+        item->allocated <<= 1;
+        item->text = REALLOC(char, item->text, item->allocated);
+    }
+    item->text[item->length++] = c;
+}
+
+static void queue_rectangle(JobQueue *q, JobItemType type, int x, int y, int w, int h)
+{
+    JobItem *item = append_job_item(q);
+    item->type = type;
+    item->x = x;
+    item->y = y;
+    item->w = w;
+    item->h = h;
+    item->done = 0;
+    item->word = NULL;
+    item->letter = NULL;
+    item->orange = NULL;
+    item->representative = -1;
+    item->shared = 0;
+}
+
+
+/* Find the items that can share recognition results (see cluster.h). */
+static void cluster_job_queue(Job *job)
+{
+    JobQueue *q = job->queue;
+    GlyphClusters g = create_glyph_clusters(job->cluster_threshold);
+    int i;
+
+    for (i = 0; i < q->count; i++)
+    {
+        JobItem *item = &q->items[i];
+        unsigned char **window;
+        int r;
+
+        if (item->type == ITEM_TEXT
+         || !rectangle_is_valid(job, item->x, item->y, item->w, item->h))
+            continue;
+
+        window = subbitmap(job->pixels, item->x, item->y, item->h);
+        r = cluster_glyph(g, i, item->type, window, item->w, item->h);
+        FREE(window);
+
+        if (r != i)
+        {
+            item->representative = r;
+            q->items[r].shared = 1;
+        }
+    }
+
+    free_glyph_clusters(g);
+}
+
+
+/* The item whose results are to be printed for this one. */
+static JobItem *result_source(JobQueue *q, JobItem *item)
+{
+    if (item->representative == -1 || item->word || item->letter)
+        return item;
+    return &q->items[item->representative];
+}
+
+
+/* Recognize an item in a worker thread.
+ * Invalid rectangles are left alone; the main thread will complain about them
+ * when it reaches them, so that the output before the error is the same.
+ */
+static void recognize_item(Worker *worker, JobItem *item)
+{
+    Job *job = worker->job;
+    unsigned char **window;
+
+    if (!rectangle_is_valid(job, item->x, item->y, item->w, item->h))
+        return;
+
+    /* The representative is taken before us, so waiting for it is safe.
+     * If it went into the orange library, we must recognize ourselves
+     * to get our own pattern there too.
+     */
+    if (item->representative != -1)
+    {
+        JobQueue *q = job->queue;
+        JobItem *r = &q->items[item->representative];
+        pthread_mutex_lock(&q->mutex);
+        while (!r->done)
+            pthread_cond_wait(&q->item_done, &q->mutex);
+        pthread_mutex_unlock(&q->mutex);
+        if (!r->orange)
+            return;
+    }
+
+    window = subbitmap(job->pixels, item->x, item->y, item->h);
+    if (item->type == ITEM_WORD)
+    {
+        unsigned char **skeleton = skeleton_window(job, item->x, item->y,
+                                                   item->w, item->h);
+        item->word = recognize_word_in_skeleton(worker->context, window, skeleton,
+                                                item->w, item->h, 0);
+        if (skeleton)
+            FREE(skeleton);
+    }
+    else
+        item->letter = recognize_letter_in_context(worker->context, window,
+                                                   item->w, item->h, 0);
+    FREE(window);
+
+    if (job->out_library_path)
+    {
+        Library orange = get_context_orange_library(worker->context);
+        if (library_shelves_count(orange))
+        {
+            item->orange = library_create();
+            library_take_shelves(item->orange, orange);
+        }
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    Worker *worker = (Worker *) arg;
+    JobQueue *q = worker->job->queue;
+
+    while (1)
+    {
+        JobItem *item;
+
+        pthread_mutex_lock(&q->mutex);
+        while (q->next_item < q->count && q->items[q->next_item].type == ITEM_TEXT)
+            q->next_item++;
+        if (q->next_item == q->count)
+        {
+            pthread_mutex_unlock(&q->mutex);
+            break;
+        }
+        item = &q->items[q->next_item++];
+        pthread_mutex_unlock(&q->mutex);
+
+        recognize_item(worker, item);
+
+        pthread_mutex_lock(&q->mutex);
+        item->done = 1;
+        pthread_cond_broadcast(&q->item_done);
+        pthread_mutex_unlock(&q->mutex);
+    }
+
+    return NULL;
+}
+
+
+static void free_item_results(JobItem *item)
+{
+    if (item->word)
+        free_recognized_word(item->word);
+    if (item->letter)
+        free_recognized_letter(item->letter);
+    item->word = NULL;
+    item->letter = NULL;
+}
+
+
+/* Print an item when it's ready and free the recognition results.
+ * Items are printed strictly in the order of the job file.
+ */
+static void output_item(Job *job, JobItem *item)
+{
+    JobQueue *q = job->queue;
+    JobItem *source;
+
+    if (item->type == ITEM_TEXT)
+    {
+        fwrite(item->text, 1, item->length, stdout);
+        return;
+    }
+
+    pthread_mutex_lock(&q->mutex);
+    while (!item->done)
+        pthread_cond_wait(&q->item_done, &q->mutex);
+    pthread_mutex_unlock(&q->mutex);
+
+    check_rectangle(job, item->x, item->y, item->w, item->h);
+
+    source = result_source(q, item);
+    if (item->type == ITEM_WORD)
+        print_recognized_word(job, source->word);
+    else
+        print_recognized_letter(job, source->letter);
+
+    /* shared results are freed by run_job_queue() */
+    if (!item->shared)
+        free_item_results(item);
+
+    if (item->orange)
+    {
+        library_take_shelves(get_core_orange_library(job->core), item->orange);
+        library_free(item->orange);
+    }
+}
+
+static void run_job_queue(Job *job)
+{
+    JobQueue *q = job->queue;
+    Worker *workers = MALLOC(Worker, job->threads);
+    int i;
+
+    for (i = 0; i < job->threads; i++)
+    {
+        workers[i].job = job;
+        workers[i].context = create_recognition_context(job->core);
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]))
+        {
+            fprintf(stderr, "unable to create a thread\n");
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < q->count; i++)
+        output_item(job, &q->items[i]);
+
+    for (i = 0; i < job->threads; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        free_recognition_context(workers[i].context);
+    }
+    FREE(workers);
+
+    for (i = 0; i < q->count; i++)
+    {
+        if (q->items[i].type != ITEM_TEXT && q->items[i].shared)
+            free_item_results(&q->items[i]);
+    }
+}
+
+
+/* ____________________________   job file   ____________________________ */
+
+
+static void emit_char(Job *job, int c)
+{
+    if (job->queue)
+        queue_char(job->queue, c);
+    else
+        putchar(c);
+}
+
 static void skip_to_end_of_tag(FILE *pjf)
 {
     int c;
@@ -156,13 +544,19 @@ static void process_tag(Job *job, FILE *pjf)
     if (!strcmp(tag, "word"))
     {
         fscanf(pjf, "%d %d %d %d", &x, &y, &w, &h);
-        process_word(job, x, y, w, h);
+        if (job->queue)
+            queue_rectangle(job->queue, ITEM_WORD, x, y, w, h);
+        else
+            process_word(job, x, y, w, h);
         skip_to_end_of_tag(pjf);
     }
     else if (!strcmp(tag, "letter"))
     {
         fscanf(pjf, "%d %d %d %d", &x, &y, &w, &h);
-        process_letter(job, x, y, w, h);
+        if (job->queue)
+            queue_rectangle(job->queue, ITEM_LETTER, x, y, w, h);
+        else
+            process_letter(job, x, y, w, h);
         skip_to_end_of_tag(pjf);
     }
     else
@@ -174,15 +568,26 @@ static void process_tag(Job *job, FILE *pjf)
 static void go(Job *job, FILE *pjf)
 {
     int c;
+
+    if (job->threads > 1 || job->cluster_threshold >= 0)
+        job->queue = create_job_queue();
+
+    if (job->page_skeleton)
+    {
+        STATS_TIME(STAT_SKELETONIZE,
+                   job->skeleton = skeletonize_page(job->pixels, job->width, job->height,
+                                                    /* 8-conn.: */ 0, job->threads));
+    }
+
     while ((c = fgetc(pjf)) != EOF)
     {
         if (c != TAG_BEGIN)
-            putchar(c);
+            emit_char(job, c);
         else
         {
             c = fgetc(pjf);
             if (c == TAG_CANCEL)
-                putchar(c);
+                emit_char(job, c);
             else
             {
                 ungetc(c, pjf);
@@ -190,6 +595,52 @@ static void go(Job *job, FILE *pjf)
             }
         }
     }
+
+    if (job->queue)
+    {
+        if (job->cluster_threshold >= 0)
+            cluster_job_queue(job);
+        run_job_queue(job);
+        destroy_job_queue(job->queue);
+        job->queue = NULL;
+    }
+
+    if (job->skeleton)
+    {
+        free_bitmap_with_margins(job->skeleton);
+        job->skeleton = NULL;
+    }
+}
+
+/* Should be called when all the work is done. */
+static void print_stats(Job *job)
+{
+#ifdef PLASMA_STATS
+    long hits, misses;
+
+    get_core_cache_stats(job->core, &hits, &misses);
+    STATS_ADD(STAT_CACHE_HITS, hits);
+    STATS_ADD(STAT_CACHE_MISSES, misses);
+    get_edit_distance_cache_stats(&hits, &misses);
+    STATS_ADD(STAT_ED_CACHE_HITS, hits);
+    STATS_ADD(STAT_ED_CACHE_MISSES, misses);
+
+    if (job->print_stats)
+        stats_print(stderr);
+    if (job->json_stats_path)
+    {
+        FILE *f = fopen(job->json_stats_path, "w");
+        if (!f)
+        {
+            perror(job->json_stats_path);
+            exit(1);
+        }
+        stats_print_json(f);
+        fclose(f);
+    }
+#else
+    fprintf(stderr, "statistics are not compiled in (build with `make STATS=y')\n");
+#endif
 }
 
 #ifndef TESTING
@@ -243,6 +694,55 @@ int main(int argc, char **argv)
                 i++; if (!arg) usage();
                 job.job_file_path = arg;
             }
+            else if (!strcmp(opt, "-J") || !strcmp(opt, "--jobs"))
+            {
+                i++; if (!arg) usage();
+                job.threads = atoi(arg);
+                if (job.threads < 1) usage();
+            }
+            else if (!strcmp(opt, "-k") || !strcmp(opt, "--cluster"))
+            {
+                i++; if (!arg) usage();
+                job.cluster_threshold = atol(arg);
+                if (job.cluster_threshold < 0) usage();
+            }
+            else if (!strcmp(opt, "--stats"))
+            {
+                job.print_stats = 1;
+            }
+            else if (!strcmp(opt, "--json-stats"))
+            {
+                i++; if (!arg) usage();
+                job.json_stats_path = arg;
+            }
+            else if (!strcmp(opt, "-C") || !strcmp(opt, "--cache"))
+            {
+                i++; if (!arg) usage();
+                if (atoi(arg) < 0) usage();
+                set_core_cache_size(job.core, atoi(arg));
+            }
+            else if (!strcmp(opt, "--fingerprint-index"))
+            {
+                i++; if (!arg) usage();
+                if (atoi(arg) < 0) usage();
+                set_core_fingerprint_index(job.core, atoi(arg));
+            }
+            else if (!strcmp(opt, "--size-limit"))
+            {
+                i++; if (!arg) usage();
+                if (atoi(arg) < 0) usage();
+                set_pattern_size_limit(atoi(arg));
+            }
+            else if (!strcmp(opt, "--page-skeleton"))
+            {
+                job.page_skeleton = 1;
+            }
+            else if (!strcmp(opt, "--ed-cache"))
+            {
+                i++; if (!arg) usage();
+                if (atoi(arg) < 0) usage();
+                set_edit_distance_cache_size(atoi(arg));
+            }
             else if (!strcmp(opt, "-i") || !strcmp(opt, "--in"))
             {
                 i++; if (!arg) usage();
@@ -309,6 +809,9 @@ int main(int argc, char **argv)
     if (job.out_library_path)
         library_save(get_core_orange_library(job.core), job.out_library_path, job.append);
 
+    if (job.print_stats || job.json_stats_path)
+        print_stats(&job);
+
     free_bitmap(job.pixels);
     free_core(job.core);
     return 0;
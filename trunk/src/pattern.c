@@ -5,14 +5,19 @@
 #include "thinning.h"
 #include "bitmaps.h"
 #include "editdist.h"
+#include "ropetrie.h"
 #include "io.h"
 #include "pnm.h"
+#include "stats.h"
 #include <assert.h>
 #include <string.h>
 
 #define MAX_SIZE_DIFF_COEF 1.3
 #define COMMON_HALF_PERIMETER 32
 
+/* Steps are keypad digits '1'..'9'; reversing a step maps k to STEP_KINDS - 1 - k. */
+#define STEP_KINDS 9
+
 
 struct MatchStruct
 {
@@ -30,16 +35,44 @@ struct PatternStruct
     float *rope_medians_x;
     float *rope_medians_y;
     char **ropes_backwards;
+    int *rope_histograms;       /* STEP_KINDS counts per rope */
+    int *rope_terminals;        /* frozen only: the trie nodes of ropes and their reversals,
+                                   valid once the trie is built */
     Fingerprint fingerprint;
 };
 
 
 struct PatternCacheStruct
 {
-    unsigned char **framework;
+    unsigned char **framework;  /* reduced `factor' times */
+    int factor;
+    int own_framework;          /* 0 if it's a window of a page skeleton */
+    Projection projection;      /* of the pixels, for bboxes and fingerprints */
 };
 
 
+/* See set_pattern_size_limit(); 0 means no limit. */
+static int size_limit = 0;
+
+
+void set_pattern_size_limit(int half_perimeter)
+{
+    assert(half_perimeter >= 0);
+    size_limit = half_perimeter;
+}
+
+
+/* How many times to shrink a bitmap of the given half-perimeter
+ * to get it under the limit.
+ */
+static int reduction_factor(int half_perimeter)
+{
+    if (!size_limit || half_perimeter <= size_limit)
+        return 1;
+    return (half_perimeter + size_limit - 1) / size_limit;
+}
+
+
 static void copy_node_coordinates(Pattern p)
 {
     int n = p->cc->node_count;
@@ -74,10 +107,30 @@ static void compute_rope_medians(Pattern p)
 }
 
 
+static void compute_rope_histograms(Pattern p)
+{
+    int r = p->cc->rope_count;
+    int *h = MALLOC(int, r * STEP_KINDS);
+    int i, j;
+
+    memset(h, 0, r * STEP_KINDS * sizeof(int));
+    for (i = 0; i < r; i++)
+    {
+        Rope *rope = &p->cc->ropes[i];
+        for (j = 0; j < rope->length; j++)
+            h[i * STEP_KINDS + rope->steps[j] - '1']++;
+    }
+
+    p->rope_histograms = h;
+}
+
+
 static void chaincode_into_pattern(Pattern p, Chaincode *cc)
 {
     p->cc = cc;    
     copy_node_coordinates(p);
+    compute_rope_histograms(p);
+    p->rope_terminals = NULL;
     p->ropes_backwards = NULL;
 }
 
@@ -104,9 +157,22 @@ Pattern create_pattern(unsigned char **pixels, int width, int height)
     unsigned char **window;
     int w, h;
     int free_window = get_bbox_window(pixels, width, height, &window, &w, &h); 
-    
-    Chaincode *cc = chaincode_compute(window, w, h);
-    Pattern p = chaincode_to_pattern_scaled(cc);
+    int factor = reduction_factor(w + h);
+    Chaincode *cc;
+    Pattern p;
+
+    if (factor > 1)
+    {
+        Projection projection = create_projection_bw(window, 0, 0, w, h);
+        unsigned char **reduced = reduce_bitmap_in_projection(projection, 0, 0, w, h, factor);
+        cc = chaincode_compute(reduced, (w + factor - 1) / factor, (h + factor - 1) / factor);
+        free_bitmap(reduced);
+        free_projection(projection);
+    }
+    else
+        cc = chaincode_compute(window, w, h);
+
+    p = chaincode_to_pattern_scaled(cc);
     chaincode_destroy(cc);
     get_fingerprint_bw(pixels, w, h, &p->fingerprint);
     
@@ -117,27 +183,73 @@ Pattern create_pattern(unsigned char **pixels, int width, int height)
 }
 
 
+/* A cache is cut into letters, and a letter is about as wide as it's high,
+ * so a cache is reduced by the half-perimeter of a square letter.
+ */
 PatternCache create_pattern_cache(unsigned char **pixels, int width, int height)
 {
     PatternCache result = MALLOC1(struct PatternCacheStruct);
-    result->framework = skeletonize(pixels, width, height, /* 8-conn.: */ 0);
+    result->projection = create_projection_bw(pixels, 0, 0, width, height);
+    result->factor = reduction_factor(2 * height);
+    result->own_framework = 1;
+
+    if (result->factor > 1)
+    {
+        int f = result->factor;
+        unsigned char **reduced = reduce_bitmap_in_projection(result->projection,
+                                                              0, 0, width, height, f);
+        STATS_TIME(STAT_SKELETONIZE,
+                   result->framework = skeletonize(reduced, (width + f - 1) / f,
+                                                   (height + f - 1) / f, /* 8-conn.: */ 0));
+        free_bitmap(reduced);
+    }
+    else
+    {
+        STATS_TIME(STAT_SKELETONIZE,
+                   result->framework = skeletonize(pixels, width, height, /* 8-conn.: */ 0));
+    }
+
+    return result;
+}
+
+PatternCache create_pattern_cache_with_skeleton(unsigned char **pixels,
+                                                int width, int height,
+                                                unsigned char **skeleton)
+{
+    PatternCache result;
+
+    if (reduction_factor(2 * height) > 1)
+        return create_pattern_cache(pixels, width, height);
+
+    result = MALLOC1(struct PatternCacheStruct);
+    result->framework = skeleton;
+    result->factor = 1;
+    result->own_framework = 0;
+    result->projection = create_projection_bw(pixels, 0, 0, width, height);
     return result;
 }
 
 void destroy_pattern_cache(PatternCache p)
 {
-    free_bitmap_with_margins(p->framework);
+    if (p->own_framework)
+        free_bitmap_with_margins(p->framework);
+    free_projection(p->projection);
     FREE1(p);
 }
 
+Projection get_pattern_cache_projection(PatternCache p)
+{
+    return p->projection;
+}
+
 
 Pattern create_pattern_from_cache(unsigned char **pixels, int width, int height,
                                   int left, int top, int p_w, int p_h,
                                   PatternCache pc)
 {
     unsigned char **buffer;
+    int f, r_left, r_top, r_w, r_h;
     Chaincode *cc;
-    int i;
     Pattern p;
     
     assert(p_w > 0);
@@ -147,20 +259,23 @@ Pattern create_pattern_from_cache(unsigned char **pixels, int width, int height,
     assert(left + p_w <= width);
     assert(top  + p_h <= height);
 
-    tighten_to_bbox(pixels, width, &left, &top, &p_w, &p_h);
-    buffer = allocate_bitmap_with_white_margins(p_w, p_h);
+    tighten_to_bbox_in_projection(pc->projection, &left, &top, &p_w, &p_h);
+
+    /* the blocks of the reduced framework covering the bbox */
+    f = pc->factor;
+    r_left = left / f;
+    r_top = top / f;
+    r_w = (left + p_w + f - 1) / f - r_left;
+    r_h = (top + p_h + f - 1) / f - r_top;
 
-    assign_bitmap_with_offsets(buffer, pc->framework + top, p_w, p_h, 0, left);
-    cc = chaincode_compute_internal(buffer, p_w, p_h);
+    buffer = allocate_bitmap_with_white_margins(r_w, r_h);
+    assign_bitmap_with_offsets(buffer, pc->framework + r_top, r_w, r_h, 0, r_left);
+    STATS_TIME(STAT_CHAINCODE, cc = chaincode_compute_internal(buffer, r_w, r_h));
     free_bitmap_with_margins(buffer);
     p = chaincode_to_pattern_scaled(cc);
     chaincode_destroy(cc);
     
-    buffer = MALLOC(unsigned char *, p_h);
-    for (i = 0; i < p_h; i++)
-        buffer[i] = pixels[i + top] + left;
-    get_fingerprint_bw(buffer, p_w, p_h, &p->fingerprint);
-    FREE(buffer);
+    get_fingerprint_in_projection(pc->projection, left, top, p_w, p_h, &p->fingerprint);
     return p;
 }
 
@@ -322,19 +437,46 @@ Match match_patterns(Pattern p1, Pattern p2)
 }
 
 
+/* Which way the rope i of p1 goes along its counterpart in p2:
+ * 1 - forwards, -1 - backwards, 0 - the ends don't match at all.
+ */
+static int rope_direction(Match m, Pattern p1, Pattern p2, int i)
+{
+    Rope *r1 = &p1->cc->ropes[i];
+    Rope *r2 = &p2->cc->ropes[m->rope_mapping[i]];
+    int s1 = m->node_mapping[r1->start];
+    int e1 = m->node_mapping[r1->end];
+
+    if (s1 == r2->start && e1 == r2->end)
+        return 1;
+    else if (s1 == r2->end && e1 == r2->start)
+        return -1;
+    else
+        return 0;
+}
+
+
 int compare_patterns(int radius, Match m, Pattern p1, Pattern p2, int *penalty)
+{
+    return compare_patterns_bounded(radius, m, p1, p2, NO_CUTOFF, penalty);
+}
+
+
+int compare_patterns_bounded(int radius, Match m, Pattern p1, Pattern p2,
+                             int cutoff, int *penalty)
 {
     int r = p1->cc->rope_count;
     int i;
     int result = 1;
-    int *node_mapping;
     int *rope_mapping;
     char **back;
+    int mismatch;       /* the first rope with wrong ends */
+    long rest = 0;      /* the lower bound for the ropes after i (up to the mismatch) */
+    long sum = 0;
     
     if (!m) return 0;
     assert(r == p2->cc->rope_count);
 
-    node_mapping = m->node_mapping;
     rope_mapping = m->rope_mapping;
 
     if (m->swap) /* p1 should be promoted */
@@ -347,36 +489,216 @@ int compare_patterns(int radius, Match m, Pattern p1, Pattern p2, int *penalty)
     back = p1->ropes_backwards;
 
     if (penalty) *penalty = 0;
+
+    /* Find out which ropes will be compared at all.
+     * Note that the ropes before a mismatch still count in the penalty.
+     */
+    for (mismatch = 0; mismatch < r; mismatch++)
+    {
+        if (!rope_direction(m, p1, p2, mismatch))
+            break;
+        rest += edit_distance_lower_bound(radius, p1->cc->ropes[mismatch].length,
+                                          p2->cc->ropes[rope_mapping[mismatch]].length);
+    }
+
+    if (mismatch < r)
+    {
+        result = 0;
+        if (!penalty) return 0;
+    }
     
     /* Now pass all the ropes, applying editing distance */
-    for (i = 0; i < r; i++)
+    for (i = 0; i < mismatch; i++)
     {
         Rope *r1 = &p1->cc->ropes[i];
         Rope *r2 = &p2->cc->ropes[rope_mapping[i]];
-        int s1 = node_mapping[r1->start];
-        int e1 = node_mapping[r1->end];
-        int s2 = r2->start;
-        int e2 = r2->end;
+        const char *steps = rope_direction(m, p1, p2, i) > 0 ? r1->steps : back[i];
+        long budget;
         int ed;
-        
-        if (s1 == s2 && e1 == e2)
-            ed = edit_distance(radius, r1->steps, r1->length, r2->steps, r2->length);
-        else if (s1 == e2 && e1 == s2)            
-            ed = edit_distance(radius, back[i], r1->length, r2->steps, r2->length);
-        else
-            return 0;
-        
+
+        rest -= edit_distance_lower_bound(radius, r1->length, r2->length);
+
+        /* If this rope costs more than `budget', the total is over the cutoff.
+         * But while the result is green, we still have to tell 0 from 1.
+         */
+        budget = penalty ? cutoff - sum - rest : 0;
+        if (result && budget < 0)
+            budget = 0;
+        if (budget > NO_CUTOFF)
+            budget = NO_CUTOFF;
+
+        STATS_TIME(STAT_EDIT_DISTANCE,
+            ed = edit_distance_bounded(radius, steps, r1->length, r2->steps, r2->length,
+                                       (int) budget));
+
         if (ed > 0)
             result = 0;
         
         if (!result && !penalty) return 0;
-        *penalty += ed; 
+
+        if (ed > budget)
+        {
+            /* the total is over the cutoff and the ropes are not green */
+            *penalty = cutoff + 1;
+            return 0;
+        }
+
+        sum += ed;
+        *penalty = (int) sum;
     }
 
     return result;
 }
 
 
+/* The ropes of p1 to compare, in the order of p1's ropes, up to the first
+ * one with mismatching ends: for the i-th rope, which rope of p2 it goes with
+ * and in which direction. Returns the number of such ropes.
+ */
+static int list_rope_pairs(Match m, Pattern p1, Pattern p2, int *partners, int *directions)
+{
+    int r = p1->cc->rope_count;
+    int i;
+
+    for (i = 0; i < r; i++)
+    {
+        directions[i] = rope_direction(m, p1, p2, i);
+        if (!directions[i])
+            break;
+        partners[i] = m->rope_mapping[i];
+    }
+    return i;
+}
+
+
+/* Sum up the distances of the ropes like compare_patterns_bounded() does. */
+static int sum_rope_distances(int r, int compared, const int *distances,
+                              int cutoff, int *penalty)
+{
+    int good = compared == r;
+    int i;
+
+    *penalty = 0;
+    for (i = 0; i < compared; i++)
+    {
+        if (distances[i] > 0)
+            good = 0;
+        if (distances[i] > cutoff - *penalty)
+        {
+            *penalty = cutoff + 1;
+            return 0;
+        }
+        *penalty += distances[i];
+    }
+    return good;
+}
+
+
+/* For each rope of p2, we queue the ropes of all the patterns mapped to it,
+ * so that edit_distances() gets many strings against the same one.
+ */
+void compare_patterns_many(int radius, int count, Match *matches, Pattern *patterns,
+                           Pattern p2, int *good, int *penalties)
+{
+    int r = p2->cc->rope_count;
+    EditDistanceQueue *queues = MALLOC(EditDistanceQueue, r);
+    int *partners = MALLOC(int, r);
+    int *directions = MALLOC(int, r);
+    int *distances = MALLOC(int, count * r);
+    int *compared = MALLOC(int, count);
+    int i, k;
+
+    for (i = 0; i < r; i++)
+    {
+        Rope *rope = &p2->cc->ropes[i];
+        queues[i] = create_edit_distance_queue(radius, rope->steps, rope->length);
+    }
+
+    for (k = 0; k < count; k++)
+    {
+        Match m = matches[k];
+        Pattern p1 = patterns[k];
+
+        if (!m || m->swap)
+            continue;   /* compared one by one below */
+
+        assert(r == p1->cc->rope_count);
+        compared[k] = list_rope_pairs(m, p1, p2, partners, directions);
+        for (i = 0; i < compared[k]; i++)
+        {
+            edit_distance_queue_push(queues[partners[i]],
+                                     directions[i] > 0 ? p1->cc->ropes[i].steps
+                                                       : p1->ropes_backwards[i],
+                                     p1->cc->ropes[i].length, &distances[k * r + i]);
+        }
+    }
+
+    for (i = 0; i < r; i++)
+        free_edit_distance_queue(queues[i]);
+
+    for (k = 0; k < count; k++)
+    {
+        if (!matches[k] || matches[k]->swap)
+            good[k] = compare_patterns(radius, matches[k], patterns[k], p2, &penalties[k]);
+        else
+            good[k] = sum_rope_distances(r, compared[k], distances + k * r,
+                                         NO_CUTOFF, &penalties[k]);
+    }
+
+    FREE(queues);
+    FREE(partners);
+    FREE(directions);
+    FREE(distances);
+    FREE(compared);
+}
+
+
+/* Step counts can't tell the order of steps, but they are much cheaper.
+ * The bound covers the same ropes that compare_patterns() would sum up.
+ */
+int compare_patterns_lower_bound(int radius, Match m, Pattern p1, Pattern p2,
+                                 int *may_be_green)
+{
+    int r = p1->cc->rope_count;
+    int bound = 0;
+    int i, k;
+
+    if (m->swap)
+    {
+        Pattern tmp = p1;
+        p1 = p2;
+        p2 = tmp;
+    }
+
+    for (i = 0; i < r; i++)
+    {
+        int direction = rope_direction(m, p1, p2, i);
+        int j = m->rope_mapping[i];
+        int *h1 = &p1->rope_histograms[i * STEP_KINDS];
+        int *h2 = &p2->rope_histograms[j * STEP_KINDS];
+        int mismatched = 0;
+
+        if (!direction)
+        {
+            *may_be_green = 0;
+            return bound;
+        }
+
+        for (k = 0; k < STEP_KINDS; k++)
+        {
+            int diff = (direction > 0 ? h1[k] : h1[STEP_KINDS - 1 - k]) - h2[k];
+            mismatched += diff < 0 ? -diff : diff;
+        }
+
+        bound += edit_distance_lower_bound_by_counts(radius, p1->cc->ropes[i].length,
+                                                     p2->cc->ropes[j].length, mismatched);
+    }
+
+    *may_be_green = bound <= 0;
+    return bound;
+}
+
+
 void destroy_match(Match m)
 {
     if (!m) return;
@@ -413,6 +735,7 @@ void free_pattern(Pattern p)
     if (p->nodes_y) FREE(p->nodes_y);
     if (p->rope_medians_x) FREE(p->rope_medians_x);
     if (p->rope_medians_y) FREE(p->rope_medians_y);
+    if (p->rope_histograms) FREE(p->rope_histograms);
     FREE1(p);
 }
 
@@ -423,6 +746,69 @@ int pattern_size_test(Pattern p1, Pattern p2)
     return !(a > MAX_SIZE_DIFF_COEF * b || b > MAX_SIZE_DIFF_COEF * a);
 }
 
+/* Degrees are small, so sorting them is just counting. */
+#define MAX_SORTED_DEGREE 8
+
+static void count_degrees(Pattern p, int *counts)
+{
+    int i;
+    memset(counts, 0, (MAX_SORTED_DEGREE + 1) * sizeof(int));
+    for (i = 0; i < p->cc->node_count; i++)
+    {
+        int d = p->cc->nodes[i].degree;
+        counts[d < MAX_SORTED_DEGREE ? d : MAX_SORTED_DEGREE]++;
+    }
+}
+
+unsigned long pattern_topology_hash(Pattern p)
+{
+    int counts[MAX_SORTED_DEGREE + 1];
+    unsigned long h = p->cc->node_count * 31UL + p->cc->rope_count;
+    int i;
+    count_degrees(p, counts);
+    for (i = 0; i <= MAX_SORTED_DEGREE; i++)
+        h = h * 1000003UL + counts[i];
+    return h;
+}
+
+int patterns_topology_equal(Pattern p1, Pattern p2)
+{
+    int c1[MAX_SORTED_DEGREE + 1];
+    int c2[MAX_SORTED_DEGREE + 1];
+    int i, n = p1->cc->node_count;
+
+    if (n != p2->cc->node_count || p1->cc->rope_count != p2->cc->rope_count)
+        return 0;
+
+    count_degrees(p1, c1);
+    count_degrees(p2, c2);
+    if (memcmp(c1, c2, sizeof(c1)))
+        return 0;
+
+    /* the rare nodes with huge degrees are compared the slow way */
+    if (!c1[MAX_SORTED_DEGREE])
+        return 1;
+    for (i = 0; i < n; i++)
+    {
+        int d = p1->cc->nodes[i].degree;
+        int j, k = 0;
+        if (d < MAX_SORTED_DEGREE) continue;
+        for (j = 0; j < n; j++)
+        {
+            if (p1->cc->nodes[j].degree == d) k++;
+            if (p2->cc->nodes[j].degree == d) k--;
+        }
+        if (k) return 0;
+    }
+    return 1;
+}
+
+
+unsigned char *get_pattern_fingerprint(Pattern p)
+{
+    return p->fingerprint;
+}
+
 long patterns_shiftcut_dist(Pattern p1, Pattern p2)
 {
     if (!pattern_size_test(p1, p2))
@@ -431,6 +817,309 @@ long patterns_shiftcut_dist(Pattern p1, Pattern p2)
     return fingerprint_distance_squared(p1->fingerprint, p2->fingerprint);
 }
 
+long patterns_shiftcut_dist_bounded(Pattern p1, Pattern p2, long bound)
+{
+    if (!pattern_size_test(p1, p2))
+        return 0x7FFFFFFFL;
+
+    return fingerprint_distance_squared_bounded(p1->fingerprint, p2->fingerprint, bound);
+}
+
+/* ______________________________   frozen patterns   __________________________________ */
+
+
+/* Sections of a frozen block start at multiples of this. */
+#define FROZEN_ALIGNMENT 64
+
+
+struct FrozenPatternsStruct
+{
+    int count;
+    struct PatternStruct *patterns;
+    char *block;                /* as returned by malloc() */
+    RopeTrie ropes;             /* all the ropes, forwards and backwards;
+                                   NULL until build_frozen_rope_trie() */
+};
+
+
+static size_t align_up(size_t n)
+{
+    return (n + FROZEN_ALIGNMENT - 1) & ~(size_t) (FROZEN_ALIGNMENT - 1);
+}
+
+
+FrozenPatterns freeze_patterns(int count, Pattern *patterns)
+{
+    FrozenPatterns f = MALLOC1(struct FrozenPatternsStruct);
+    int total_nodes = 0, total_ropes = 0, total_indices = 0, total_steps = 0;
+    size_t patterns_at, chaincodes_at, floats_at, nodes_at, ropes_at;
+    size_t backwards_at, indices_at, histograms_at, terminals_at, steps_at, size;
+    char *base;
+    Chaincode *chaincodes;
+    float *floats;
+    Node *nodes;
+    Rope *ropes;
+    char **backwards;
+    int *indices;
+    int *histograms;
+    int *terminals;
+    char *steps;
+    int i, j;
+
+    for (i = 0; i < count; i++)
+    {
+        Chaincode *cc = patterns[i]->cc;
+        total_nodes += cc->node_count;
+        total_ropes += cc->rope_count;
+        for (j = 0; j < cc->node_count; j++)
+            total_indices += cc->nodes[j].degree;
+        for (j = 0; j < cc->rope_count; j++)
+            total_steps += cc->ropes[j].length;
+    }
+
+    /* lay out the sections */
+    patterns_at   = 0;
+    chaincodes_at = align_up(patterns_at   + count * sizeof(struct PatternStruct));
+    floats_at     = align_up(chaincodes_at + count * sizeof(Chaincode));
+    nodes_at      = align_up(floats_at     + 2 * (total_nodes + total_ropes) * sizeof(float));
+    ropes_at      = align_up(nodes_at      + total_nodes * sizeof(Node));
+    backwards_at  = align_up(ropes_at      + total_ropes * sizeof(Rope));
+    indices_at    = align_up(backwards_at  + total_ropes * sizeof(char *));
+    histograms_at = align_up(indices_at    + total_indices * sizeof(int));
+    terminals_at  = align_up(histograms_at + total_ropes * STEP_KINDS * sizeof(int));
+    steps_at      = align_up(terminals_at  + 2 * total_ropes * sizeof(int));
+    size          = align_up(steps_at      + 2 * total_steps);
+
+    f->count = count;
+    f->ropes = NULL;
+    f->block = MALLOC(char, size + FROZEN_ALIGNMENT);
+    base = f->block + (FROZEN_ALIGNMENT - (size_t) f->block % FROZEN_ALIGNMENT) % FROZEN_ALIGNMENT;
+
+    f->patterns = (struct PatternStruct *) (base + patterns_at);
+    chaincodes  = (Chaincode *) (base + chaincodes_at);
+    floats      = (float *) (base + floats_at);
+    nodes       = (Node *) (base + nodes_at);
+    ropes       = (Rope *) (base + ropes_at);
+    backwards   = (char **) (base + backwards_at);
+    indices     = (int *) (base + indices_at);
+    histograms  = (int *) (base + histograms_at);
+    terminals   = (int *) (base + terminals_at);
+    steps       = base + steps_at;
+
+    /* Coordinates go in runs: all x's of nodes, then all y's,
+     * then the same for rope medians.
+     */
+    {
+        float *nodes_x = floats;
+        float *nodes_y = nodes_x + total_nodes;
+        float *medians_x = nodes_y + total_nodes;
+        float *medians_y = medians_x + total_ropes;
+        char *back_steps = steps + total_steps;
+
+        for (i = 0; i < count; i++)
+        {
+            Pattern src = patterns[i];
+            Pattern dst = &f->patterns[i];
+            Chaincode *cc = src->cc;
+            int n = cc->node_count;
+            int r = cc->rope_count;
+
+            *dst = *src;
+            dst->cc = &chaincodes[i];
+            *dst->cc = *cc;
+            dst->cc->node_allocated = n;
+            dst->cc->rope_allocated = r;
+
+            dst->nodes_x = nodes_x;
+            dst->nodes_y = nodes_y;
+            memcpy(nodes_x, src->nodes_x, n * sizeof(float));
+            memcpy(nodes_y, src->nodes_y, n * sizeof(float));
+            nodes_x += n;
+            nodes_y += n;
+
+            dst->rope_medians_x = medians_x;
+            dst->rope_medians_y = medians_y;
+            memcpy(medians_x, src->rope_medians_x, r * sizeof(float));
+            memcpy(medians_y, src->rope_medians_y, r * sizeof(float));
+            medians_x += r;
+            medians_y += r;
+
+            dst->rope_histograms = histograms;
+            memcpy(histograms, src->rope_histograms, r * STEP_KINDS * sizeof(int));
+            histograms += r * STEP_KINDS;
+
+            dst->cc->nodes = nodes;
+            for (j = 0; j < n; j++)
+            {
+                nodes[j] = cc->nodes[j];
+                nodes[j].rope_indices = indices;
+                memcpy(indices, cc->nodes[j].rope_indices,
+                       cc->nodes[j].degree * sizeof(int));
+                indices += cc->nodes[j].degree;
+            }
+            nodes += n;
+
+            dst->cc->ropes = ropes;
+            dst->ropes_backwards = src->ropes_backwards ? backwards : NULL;
+            dst->rope_terminals = terminals;
+            for (j = 0; j < r; j++)
+            {
+                int length = cc->ropes[j].length;
+                ropes[j] = cc->ropes[j];
+                ropes[j].steps = steps;
+                memcpy(steps, cc->ropes[j].steps, length);
+                steps += length;
+                if (src->ropes_backwards)
+                {
+                    backwards[j] = src->ropes_backwards[j] ? back_steps : NULL;
+                    if (length)
+                        memcpy(back_steps, src->ropes_backwards[j], length);
+                    back_steps += length;
+                }
+            }
+            ropes += r;
+            backwards += r;
+            terminals += 2 * r;
+        }
+    }
+
+    return f;
+}
+
+
+/* (see pattern.h) */
+void build_frozen_rope_trie(FrozenPatterns f)
+{
+    RopeTrie trie;
+    int i, j;
+
+    if (f->ropes)
+        return;
+
+    trie = create_rope_trie();
+    for (i = 0; i < f->count; i++)
+    {
+        Pattern p = &f->patterns[i];
+        Rope *ropes = p->cc->ropes;
+
+        for (j = 0; j < p->cc->rope_count; j++)
+        {
+            int length = ropes[j].length;
+            const char *back;
+
+            p->rope_terminals[2 * j] = rope_trie_add(trie, ropes[j].steps, length);
+            p->rope_terminals[2 * j + 1] = -1;
+            if (p->ropes_backwards)
+            {
+                back = p->ropes_backwards[j] ? p->ropes_backwards[j] : ropes[j].steps;
+                p->rope_terminals[2 * j + 1] = rope_trie_add(trie, back, length);
+            }
+        }
+    }
+
+    finish_rope_trie(trie);
+    f->ropes = trie;
+}
+
+
+Pattern get_frozen_pattern(FrozenPatterns f, int index)
+{
+    assert(index >= 0 && index < f->count);
+    return &f->patterns[index];
+}
+
+
+void free_frozen_patterns(FrozenPatterns f)
+{
+    if (f->ropes)
+        free_rope_trie(f->ropes);
+    FREE(f->block);
+    FREE1(f);
+}
+
+
+/* Same as compare_patterns_many(), but the ropes are looked up in the trie
+ * of the frozen patterns: for each rope of p2, one walk over the trie
+ * gives the distances to all the ropes mapped to it. A rope over the cutoff
+ * puts its pattern over it, so the walk drops such branches.
+ */
+void compare_frozen_patterns_many(FrozenPatterns f, int radius, int cutoff, int count,
+                                  Match *matches, Pattern *patterns,
+                                  Pattern p2, int *good, int *penalties)
+{
+    int r = p2->cc->rope_count;
+    int *partners = MALLOC(int, count * r);
+    int *directions = MALLOC(int, count * r);
+    int *distances = MALLOC(int, count * r);
+    int *compared = MALLOC(int, count);
+    int *terminals = MALLOC(int, count * r);
+    int *results = MALLOC(int, count * r);
+    int *origins = MALLOC(int, count * r);
+    int i, k, q;
+
+    assert(f->ropes);
+
+    /* while the result is green, we still have to tell 0 from 1 */
+    if (cutoff < 0)
+        cutoff = 0;
+
+    for (k = 0; k < count; k++)
+    {
+        Match m = matches[k];
+        compared[k] = 0;
+        if (m && !m->swap)
+        {
+            assert(patterns[k]->rope_terminals);
+            assert(r == patterns[k]->cc->rope_count);
+            compared[k] = list_rope_pairs(m, patterns[k], p2,
+                                          partners + k * r, directions + k * r);
+        }
+    }
+
+    for (q = 0; q < r; q++)
+    {
+        Rope *rope = &p2->cc->ropes[q];
+        int n = 0;
+
+        for (k = 0; k < count; k++)
+        {
+            for (i = 0; i < compared[k]; i++)
+            {
+                if (partners[k * r + i] != q)
+                    continue;
+                terminals[n] = patterns[k]->rope_terminals[2 * i
+                                                         + (directions[k * r + i] < 0)];
+                origins[n] = k * r + i;
+                n++;
+            }
+        }
+
+        rope_trie_search(f->ropes, radius, rope->steps, rope->length,
+                         n, terminals, cutoff, results);
+        for (i = 0; i < n; i++)
+            distances[origins[i]] = results[i];
+    }
+
+    for (k = 0; k < count; k++)
+    {
+        if (!matches[k] || matches[k]->swap)
+            good[k] = compare_patterns_bounded(radius, matches[k], patterns[k], p2,
+                                               cutoff, &penalties[k]);
+        else
+            good[k] = sum_rope_distances(r, compared[k], distances + k * r,
+                                         cutoff, &penalties[k]);
+    }
+
+    FREE(partners);
+    FREE(directions);
+    FREE(distances);
+    FREE(compared);
+    FREE(terminals);
+    FREE(results);
+    FREE(origins);
+}
+
+
 /* ______________________________   testing   __________________________________ */
 
 #ifdef TESTING
@@ -446,6 +1135,7 @@ void assert_patterns_equal(Pattern p1, Pattern p2)
     assert(!memcmp(p1->nodes_y, p2->nodes_y, n * sizeof(float)));
     assert(!memcmp(p1->rope_medians_x, p2->rope_medians_x, r * sizeof(float)));
     assert(!memcmp(p1->rope_medians_y, p2->rope_medians_y, r * sizeof(float)));
+    assert(!memcmp(p1->rope_histograms, p2->rope_histograms, r * STEP_KINDS * sizeof(int)));
     assert(!memcmp(p1->fingerprint, p2->fingerprint, sizeof(Fingerprint)));
 }
 
@@ -485,8 +1175,42 @@ static void test_save_load(void)
     file_pair_close(fp);
 }
 
+static void test_freeze(void)
+{
+    unsigned char **pixels;
+    Pattern p[2];
+    FrozenPatterns f;
+    int w, h, i, penalty;
+    Match m;
+
+    load_pnm("test/i.pbm", &pixels, &w, &h);
+    p[0] = create_pattern(pixels, w, h);
+    p[1] = create_pattern(pixels, w, h);
+    promote_pattern(p[0]);
+    f = freeze_patterns(2, p);
+
+    assert((size_t) get_frozen_pattern(f, 0) % 64 == 0);
+    for (i = 0; i < 2; i++)
+    {
+        Pattern frozen = get_frozen_pattern(f, i);
+        assert_patterns_equal(p[i], frozen);
+        assert(patterns_topology_equal(p[i], frozen));
+    }
+
+    m = match_patterns(get_frozen_pattern(f, 0), p[1]);
+    assert(m);
+    assert(compare_patterns(50, m, get_frozen_pattern(f, 0), p[1], &penalty));
+    destroy_match(m);
+
+    free_frozen_patterns(f);
+    free_pattern(p[0]);
+    free_pattern(p[1]);
+    free_bitmap(pixels);
+}
+
 TestFunction tests[] = {
     test_save_load, 
+    test_freeze,
     NULL
 };
 
@@ -3,6 +3,7 @@
 
 
 #include <stdio.h>
+#include "shiftcut.h"
 
 
 /* A pattern is a function of image that can be matched with other patterns.
@@ -24,6 +25,27 @@ Pattern create_pattern_from_cache(unsigned char **pixels, int width, int height,
                                   int left, int top, int w, int h, PatternCache p);
 void destroy_pattern_cache(PatternCache);
 
+/* The same as create_pattern_cache(), but with a ready skeleton of the pixels,
+ * as skeletonize() (8-conn.: 0) would make it. Only rows 0..height-1
+ * and columns 0..width-1 are used, so it may be a window of a page skeleton.
+ * The skeleton is not copied and must outlive the cache.
+ * It's ignored if the pixels are to be shrunk (see set_pattern_size_limit()).
+ */
+PatternCache create_pattern_cache_with_skeleton(unsigned char **pixels,
+                                                int width, int height,
+                                                unsigned char **skeleton);
+
+/* Patterns are compared at a half-perimeter of about 32, so thinning a huge glyph
+ * at full resolution is mostly wasted. With a limit set, a glyph (or a cache
+ * of glyphs of that height) whose half-perimeter is bigger
+ * is first shrunk by an integer factor to fit, then thinned.
+ * 0 (the default) means no limit. Should be set before patterns are made.
+ */
+void set_pattern_size_limit(int half_perimeter);
+
+/* The black-and-white projection of the pixels the cache was made of. */
+Projection get_pattern_cache_projection(PatternCache);
+
 
 
 typedef struct MatchStruct *Match;
@@ -31,11 +53,71 @@ typedef struct MatchStruct *Match;
 void promote_pattern(Pattern);
 Match match_patterns(Pattern p1, Pattern p2);
 int compare_patterns(int radius, Match m, Pattern p1, Pattern p2, int *penalty);
+
+/* Same as compare_patterns(), but the penalty is only exact if it's <= cutoff;
+ * otherwise it's just something bigger. Whether the match is green is always exact.
+ */
+int compare_patterns_bounded(int radius, Match m, Pattern p1, Pattern p2,
+                             int cutoff, int *penalty);
+
+/* Same as compare_patterns() on each of `patterns' against p2,
+ * but the edit distances are computed in batches.
+ * A NULL match gives 0 with an undefined penalty.
+ */
+void compare_patterns_many(int radius, int count, Match *matches, Pattern *patterns,
+                           Pattern p2, int *good, int *penalties);
+
+/* A cheap lower bound on the penalty of compare_patterns().
+ * `may_be_green' is set to 0 if compare_patterns() surely returns 0.
+ */
+int compare_patterns_lower_bound(int radius, Match m, Pattern p1, Pattern p2,
+                                 int *may_be_green);
 long patterns_shiftcut_dist(Pattern p1, Pattern p2);
+
+/* The same, but exact only up to `bound' (see fingerprint_distance_squared_bounded()). */
+long patterns_shiftcut_dist_bounded(Pattern p1, Pattern p2, long bound);
+
 void destroy_match(Match);
 
 int pattern_size_test(Pattern p1, Pattern p2);
 
+/* The fingerprint behind patterns_shiftcut_dist(). */
+unsigned char *get_pattern_fingerprint(Pattern p);
+
+
+/* The topology of a pattern is the number of nodes, the number of ropes
+ * and the multiset of node degrees of its chaincode.
+ * Patterns with different topologies never match.
+ */
+unsigned long pattern_topology_hash(Pattern);
+int patterns_topology_equal(Pattern, Pattern);
+
+/* A frozen copy of patterns lives in a single block of memory,
+ * so that going through many of them doesn't jump all over the heap.
+ * Frozen patterns are read-only: they can be matched, compared and so on,
+ * but not promoted, saved or freed one by one.
+ */
+typedef struct FrozenPatternsStruct *FrozenPatterns;
+
+FrozenPatterns freeze_patterns(int count, Pattern *patterns);
+Pattern get_frozen_pattern(FrozenPatterns, int index);
+void free_frozen_patterns(FrozenPatterns);
+
+/* Put the ropes of the frozen patterns into a trie for
+ * compare_frozen_patterns_many(). Does nothing the second time.
+ * Must be called before the patterns are shared between threads.
+ */
+void build_frozen_rope_trie(FrozenPatterns);
+
+/* compare_patterns_many() for frozen patterns (all from the same FrozenPatterns)
+ * that shares the work on common prefixes of ropes. Like compare_patterns_bounded(),
+ * a penalty is only exact if it's <= cutoff. Needs build_frozen_rope_trie().
+ */
+void compare_frozen_patterns_many(FrozenPatterns, int radius, int cutoff, int count,
+                                  Match *matches, Pattern *patterns,
+                                  Pattern p2, int *good, int *penalties);
+
+
 #ifdef TESTING
 
 void assert_patterns_equal(Pattern p1, Pattern p2);
@@ -0,0 +1,397 @@
+/* Plasma OCR - an OCR engine
+ *
+ * pqindex.c - an approximate index of fingerprints by product quantization
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "common.h"
+#include "pqindex.h"
+#include <assert.h>
+#include <string.h>
+
+
+#define PQ_CENTROIDS 256
+
+#if PQ_SUBSPACES != 8
+#   error "fingerprint_index_search() adds up exactly 8 table entries"
+#endif
+
+/* The longest piece; the pieces are 3, 4, 4, 4, 4, 4, 4, 4 bytes. */
+#define MAX_PIECE 4
+
+/* k-means looks at no more fingerprints than this... */
+#define TRAINING_SIZE 20000
+
+/* ...and makes no more passes than this. */
+#define TRAINING_PASSES 10
+
+
+struct FingerprintIndexStruct
+{
+    int count;
+    int centroids_count;        /* in each subspace */
+    unsigned char centroids[PQ_SUBSPACES][PQ_CENTROIDS][MAX_PIECE];
+    unsigned char *codes;       /* PQ_SUBSPACES bytes per record */
+};
+
+
+typedef struct
+{
+    long distance;
+    int index;
+} Candidate;
+
+
+static int piece_start(int subspace)
+{
+    return subspace * (int) sizeof(Fingerprint) / PQ_SUBSPACES;
+}
+
+
+static int piece_distance(unsigned char *a, unsigned char *b, int n)
+{
+    int i, s = 0;
+    for (i = 0; i < n; i++)
+    {
+        int difference = a[i] - b[i];
+        s += difference * difference;
+    }
+    return s;
+}
+
+
+/* The nearest centroid to the piece `p' (the first one of equally near). */
+static int nearest_centroid(FingerprintIndex x, int subspace, unsigned char *p, int n)
+{
+    int best = 0, best_distance = piece_distance(p, x->centroids[subspace][0], n);
+    int i;
+
+    for (i = 1; i < x->centroids_count; i++)
+    {
+        int d = piece_distance(p, x->centroids[subspace][i], n);
+        if (d < best_distance)
+        {
+            best = i;
+            best_distance = d;
+        }
+    }
+    return best;
+}
+
+
+/* k-means over the pieces of the sample, starting from pseudorandom samples.
+ * `count' must be at least x->centroids_count.
+ */
+static void train(FingerprintIndex x, int subspace, int count, Fingerprint *sample,
+                  unsigned long *seed)
+{
+    int start = piece_start(subspace);
+    int n = piece_start(subspace + 1) - start;
+    int *assignment = MALLOC(int, count);
+    long *sums = MALLOC(long, x->centroids_count * MAX_PIECE);
+    int *sizes = MALLOC(int, x->centroids_count);
+    int pass, i, j;
+
+    /* distinct samples, by a partial shuffle */
+    for (i = 0; i < count; i++)
+        assignment[i] = i;
+    for (i = 0; i < x->centroids_count; i++)
+    {
+        int swap;
+        *seed = *seed * 1103515245UL + 12345UL;
+        j = i + (int) ((*seed >> 16) % (count - i));
+        swap = assignment[i];
+        assignment[i] = assignment[j];
+        assignment[j] = swap;
+        memcpy(x->centroids[subspace][i], sample[assignment[i]] + start, n);
+    }
+    for (i = 0; i < count; i++)
+        assignment[i] = -1;
+
+    for (pass = 0; pass < TRAINING_PASSES; pass++)
+    {
+        int changed = 0;
+
+        for (i = 0; i < count; i++)
+        {
+            int c = nearest_centroid(x, subspace, sample[i] + start, n);
+            if (c != assignment[i])
+            {
+                assignment[i] = c;
+                changed = 1;
+            }
+        }
+        if (!changed)
+            break;
+
+        memset(sums, 0, x->centroids_count * MAX_PIECE * sizeof(long));
+        memset(sizes, 0, x->centroids_count * sizeof(int));
+        for (i = 0; i < count; i++)
+        {
+            sizes[assignment[i]]++;
+            for (j = 0; j < n; j++)
+                sums[assignment[i] * MAX_PIECE + j] += sample[i][start + j];
+        }
+
+        /* an empty cluster keeps its centroid */
+        for (i = 0; i < x->centroids_count; i++)
+            if (sizes[i])
+                for (j = 0; j < n; j++)
+                    x->centroids[subspace][i][j] =
+                        (unsigned char) ((sums[i * MAX_PIECE + j] + sizes[i] / 2) / sizes[i]);
+    }
+
+    FREE(assignment);
+    FREE(sums);
+    FREE(sizes);
+}
+
+
+FingerprintIndex create_fingerprint_index(int count, Fingerprint *fingerprints)
+{
+    FingerprintIndex x = MALLOC1(struct FingerprintIndexStruct);
+    int sample_count = count < TRAINING_SIZE ? count : TRAINING_SIZE;
+    Fingerprint *sample = MALLOC(Fingerprint, sample_count + 1);
+    unsigned long seed = 57;
+    int i, s;
+
+    x->count = count;
+    x->centroids_count = count < PQ_CENTROIDS ? count : PQ_CENTROIDS;
+    x->codes = MALLOC(unsigned char, count * PQ_SUBSPACES + 1);
+    memset(x->centroids, 0, sizeof(x->centroids));
+
+    /* an evenly spread sample */
+    for (i = 0; i < sample_count; i++)
+        memcpy(sample[i], fingerprints[(long) i * count / sample_count], sizeof(Fingerprint));
+
+    for (s = 0; s < PQ_SUBSPACES; s++)
+    {
+        int start = piece_start(s);
+        int n = piece_start(s + 1) - start;
+
+        if (count)
+            train(x, s, sample_count, sample, &seed);
+        for (i = 0; i < count; i++)
+            x->codes[i * PQ_SUBSPACES + s] =
+                (unsigned char) nearest_centroid(x, s, fingerprints[i] + start, n);
+    }
+
+    FREE(sample);
+    return x;
+}
+
+
+void free_fingerprint_index(FingerprintIndex x)
+{
+    FREE(x->codes);
+    FREE1(x);
+}
+
+
+/* ______________________________   search   __________________________________ */
+
+
+/* The candidates are kept in a heap with the worst one on the top. */
+
+static int worse(Candidate *a, Candidate *b)
+{
+    return a->distance > b->distance
+       || (a->distance == b->distance && a->index > b->index);
+}
+
+
+static void sift_down(Candidate *heap, int n, int i)
+{
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        Candidate swap;
+        if (child >= n)
+            return;
+        if (child + 1 < n && worse(&heap[child + 1], &heap[child]))
+            child++;
+        if (!worse(&heap[child], &heap[i]))
+            return;
+        swap = heap[i];
+        heap[i] = heap[child];
+        heap[child] = swap;
+        i = child;
+    }
+}
+
+
+static void sift_up(Candidate *heap, int i)
+{
+    while (i)
+    {
+        int parent = (i - 1) / 2;
+        Candidate swap;
+        if (!worse(&heap[i], &heap[parent]))
+            return;
+        swap = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = swap;
+        i = parent;
+    }
+}
+
+
+int fingerprint_index_search(FingerprintIndex x, Fingerprint query, int k, int *result)
+{
+    int table[PQ_SUBSPACES][PQ_CENTROIDS];      /* squared distances to the centroids */
+    Candidate *heap;
+    int heap_size = 0;
+    int i, s;
+
+    if (k > x->count)
+        k = x->count;
+    if (k <= 0)
+        return 0;
+
+    for (s = 0; s < PQ_SUBSPACES; s++)
+    {
+        int start = piece_start(s);
+        int n = piece_start(s + 1) - start;
+        for (i = 0; i < x->centroids_count; i++)
+            table[s][i] = piece_distance(query + start, x->centroids[s][i], n);
+    }
+
+    heap = MALLOC(Candidate, k);
+    for (i = 0; i < x->count; i++)
+    {
+        unsigned char *code = x->codes + i * PQ_SUBSPACES;
+        long d = table[0][code[0]] + table[1][code[1]] + table[2][code[2]]
+               + table[3][code[3]] + table[4][code[4]] + table[5][code[5]]
+               + table[6][code[6]] + table[7][code[7]];
+
+        if (heap_size < k)
+        {
+            heap[heap_size].distance = d;
+            heap[heap_size].index = i;
+            sift_up(heap, heap_size++);
+        }
+        else if (d < heap[0].distance)
+        {
+            /* the indices grow, so an equal distance is never better */
+            heap[0].distance = d;
+            heap[0].index = i;
+            sift_down(heap, k, 0);
+        }
+    }
+
+    /* pop the worst one to the end until the heap is sorted */
+    for (i = heap_size - 1; i > 0; i--)
+    {
+        Candidate swap = heap[0];
+        heap[0] = heap[i];
+        heap[i] = swap;
+        sift_down(heap, i, 0);
+    }
+    for (i = 0; i < heap_size; i++)
+        result[i] = heap[i].index;
+
+    FREE(heap);
+    return heap_size;
+}
+
+
+/* ______________________________   testing   __________________________________ */
+
+#ifdef TESTING
+
+/* With fewer records than centroids, every record is a centroid of its own,
+ * so the approximate distances are exact.
+ */
+static void test_small(void)
+{
+    int n = 200;
+    Fingerprint *f = MALLOC(Fingerprint, n);
+    int *result = MALLOC(int, n);
+    FingerprintIndex x;
+    int i, j;
+
+    srand(19);
+    for (i = 0; i < n; i++)
+        for (j = 0; j < (int) sizeof(Fingerprint); j++)
+            f[i][j] = rand() % 256;
+
+    x = create_fingerprint_index(n, f);
+    for (i = 0; i < 20; i++)
+    {
+        assert(fingerprint_index_search(x, f[i], 1, result) == 1);
+        assert(result[0] == i);
+        assert(fingerprint_index_search(x, f[i], n + 10, result) == n);
+        for (j = 1; j < n; j++)
+            assert(fingerprint_distance_squared(f[i], f[result[j - 1]])
+                <= fingerprint_distance_squared(f[i], f[result[j]]));
+    }
+    free_fingerprint_index(x);
+
+    x = create_fingerprint_index(0, f);
+    assert(fingerprint_index_search(x, f[0], 5, result) == 0);
+    free_fingerprint_index(x);
+
+    FREE(f);
+    FREE(result);
+}
+
+/* Clustered data: a record itself should almost always be
+ * among the candidates for it.
+ */
+static void test_recall(void)
+{
+    int clusters = 100, per_cluster = 10, n = clusters * per_cluster;
+    Fingerprint *f = MALLOC(Fingerprint, n);
+    int *result = MALLOC(int, 20);
+    FingerprintIndex x;
+    int i, j, found = 0;
+
+    srand(23);
+    for (i = 0; i < clusters; i++)
+        for (j = 0; j < (int) sizeof(Fingerprint); j++)
+            f[i * per_cluster][j] = 16 + rand() % 224;
+    for (i = 0; i < n; i++)
+        for (j = 0; j < (int) sizeof(Fingerprint); j++)
+            f[i][j] = f[i - i % per_cluster][j] + rand() % 17 - 8;
+
+    x = create_fingerprint_index(n, f);
+    for (i = 0; i < 100; i++)
+    {
+        int q = (i * 7919) % n;
+        int k = fingerprint_index_search(x, f[q], 20, result);
+        for (j = 0; j < k; j++)
+            if (result[j] == q)
+                found++;
+    }
+    assert(found >= 95);
+
+    free_fingerprint_index(x);
+    FREE(f);
+    FREE(result);
+}
+
+static TestFunction tests[] = {
+    test_small,
+    test_recall,
+    NULL
+};
+
+TestSuite pqindex_suite = {"pqindex", NULL, NULL, tests};
+
+#endif
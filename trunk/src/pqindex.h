@@ -0,0 +1,65 @@
+/* Plasma OCR - an OCR engine
+ *
+ * pqindex.h - an approximate index of fingerprints by product quantization
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/* For really big libraries, even the vantage-point tree is slow
+ * (and wants all the fingerprints in memory). Here a fingerprint is cut
+ * into PQ_SUBSPACES pieces, and each piece is replaced by the number
+ * of the nearest of 256 centroids learned by k-means for that piece.
+ * That's one byte per piece. A query first computes its distances to all
+ * the centroids, then the approximate distance to a record is
+ * a sum of PQ_SUBSPACES table lookups.
+ *
+ * The answer is a short list of candidates, nearest first;
+ * the caller should re-rank them with fingerprint_distance_squared().
+ */
+
+
+#ifndef PLASMA_OCR_PQINDEX_H
+#define PLASMA_OCR_PQINDEX_H
+
+
+#include "shiftcut.h"
+
+
+#define PQ_SUBSPACES 8
+
+
+typedef struct FingerprintIndexStruct *FingerprintIndex;
+
+
+/* Train the quantizers on the fingerprints and encode them all. */
+FingerprintIndex create_fingerprint_index(int count, Fingerprint *fingerprints);
+void free_fingerprint_index(FingerprintIndex);
+
+/* Put into `result' the indices of (at most) `k' records that are
+ * approximately nearest to `query', nearest first (ties by index).
+ * Returns the number of indices stored.
+ */
+int fingerprint_index_search(FingerprintIndex, Fingerprint query, int k, int *result);
+
+
+#ifdef TESTING
+extern TestSuite pqindex_suite;
+#endif
+
+
+#endif
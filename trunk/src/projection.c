@@ -0,0 +1,179 @@
+/* Plasma OCR - an OCR engine
+ *
+ * projection.c - row and column sums over rectangles in O(1)
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "common.h"
+#include "projection.h"
+#include <assert.h>
+
+
+struct ProjectionStruct
+{
+    int width, height;
+    int stride;             /* width + 1 */
+    int *sums;              /* (width + 1) * (height + 1); row 0 and column 0 are zeros */
+};
+
+
+static Projection allocate_projection(int w, int h)
+{
+    Projection p = MALLOC1(struct ProjectionStruct);
+    int i;
+
+    assert(w >= 0 && h >= 0);
+    p->width = w;
+    p->height = h;
+    p->stride = w + 1;
+    p->sums = MALLOC(int, (w + 1) * (h + 1));
+    for (i = 0; i <= w; i++)
+        p->sums[i] = 0;
+    return p;
+}
+
+
+Projection create_projection_bw(unsigned char **pixels, int x, int y, int w, int h)
+{
+    Projection p = allocate_projection(w, h);
+    int i, j;
+
+    for (i = 0; i < h; i++)
+    {
+        unsigned char *row = pixels[y + i] + x;
+        int *above = p->sums + i * p->stride;
+        int *sums = above + p->stride;
+        int s = 0;
+
+        sums[0] = 0;
+        for (j = 0; j < w; j++)
+        {
+            if (row[j]) s++;
+            sums[j + 1] = above[j + 1] + s;
+        }
+    }
+    return p;
+}
+
+
+Projection create_projection_gray(unsigned char **pixels, int x, int y, int w, int h)
+{
+    Projection p = allocate_projection(w, h);
+    int i, j;
+
+    for (i = 0; i < h; i++)
+    {
+        unsigned char *row = pixels[y + i] + x;
+        int *above = p->sums + i * p->stride;
+        int *sums = above + p->stride;
+        int s = 0;
+
+        sums[0] = 0;
+        for (j = 0; j < w; j++)
+        {
+            s += 255 - row[j];
+            sums[j + 1] = above[j + 1] + s;
+        }
+    }
+    return p;
+}
+
+
+void free_projection(Projection p)
+{
+    FREE(p->sums);
+    FREE1(p);
+}
+
+
+int get_projection_width(Projection p)
+{
+    return p->width;
+}
+
+
+int get_projection_height(Projection p)
+{
+    return p->height;
+}
+
+
+int projection_sum(Projection p, int x, int y, int w, int h)
+{
+    int *top = p->sums + y * p->stride + x;
+    int *bottom = top + h * p->stride;
+
+    assert(x >= 0 && y >= 0 && w >= 0 && h >= 0);
+    assert(x + w <= p->width && y + h <= p->height);
+    return bottom[w] - bottom[0] - top[w] + top[0];
+}
+
+
+/* ______________________________   testing   __________________________________ */
+
+#ifdef TESTING
+
+static void test_sums(void)
+{
+    unsigned char a[3][4] = {{0, 1, 0, 0},
+                             {1, 1, 0, 200},
+                             {0, 0, 0, 1}};
+    unsigned char *pa[3];
+    Projection bw, gray;
+    int x, y, w, h;
+
+    pa[0] = a[0]; pa[1] = a[1]; pa[2] = a[2];
+    bw = create_projection_bw(pa, 0, 0, 4, 3);
+    gray = create_projection_gray(pa, 0, 0, 4, 3);
+
+    for (y = 0; y <= 3; y++) for (h = 0; y + h <= 3; h++)
+    for (x = 0; x <= 4; x++) for (w = 0; x + w <= 4; w++)
+    {
+        int i, j, s_bw = 0, s_gray = 0;
+        for (i = y; i < y + h; i++)
+            for (j = x; j < x + w; j++)
+            {
+                if (a[i][j]) s_bw++;
+                s_gray += 255 - a[i][j];
+            }
+        assert(projection_sum(bw, x, y, w, h) == s_bw);
+        assert(projection_sum(gray, x, y, w, h) == s_gray);
+    }
+
+    assert(projection_row_sum(bw, 1, 0, 3) == 3);
+    assert(projection_column_sum(bw, 1, 0, 2) == 2);
+    free_projection(bw);
+    free_projection(gray);
+
+    /* a window */
+    bw = create_projection_bw(pa, 1, 1, 3, 2);
+    assert(get_projection_width(bw) == 3 && get_projection_height(bw) == 2);
+    assert(projection_sum(bw, 0, 0, 3, 2) == 3);
+    assert(projection_column_sum(bw, 2, 0, 1) == 2);
+    free_projection(bw);
+}
+
+static TestFunction tests[] = {
+    test_sums,
+    NULL
+};
+
+TestSuite projection_suite = {"projection", NULL, NULL, tests};
+
+#endif
@@ -0,0 +1,65 @@
+/* Plasma OCR - an OCR engine
+ *
+ * projection.h - row and column sums over rectangles in O(1)
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/* Shift-n-cut fingerprints, word cutting and bounding boxes all want
+ * the weight of a piece of a row or a column, again and again.
+ * A projection is a table of sums over all the top-left rectangles
+ * of a window (a summed-area table), so any rectangle costs 4 lookups.
+ * Building it costs one pass over the window.
+ */
+
+
+#ifndef PLASMA_OCR_PROJECTION_H
+#define PLASMA_OCR_PROJECTION_H
+
+
+typedef struct ProjectionStruct *Projection;
+
+
+/* Take the w * h window at (x, y) of `pixels'.
+ * In a black-and-white projection, every nonzero pixel weighs 1;
+ * in a gray one, a pixel weighs 255 minus its value.
+ * The sums are ints, so a gray window should stay under 8M pixels.
+ */
+Projection create_projection_bw(unsigned char **pixels, int x, int y, int w, int h);
+Projection create_projection_gray(unsigned char **pixels, int x, int y, int w, int h);
+void free_projection(Projection);
+
+int get_projection_width(Projection);
+int get_projection_height(Projection);
+
+/* The weight of the w * h rectangle at (x, y), relative to the window. */
+int projection_sum(Projection, int x, int y, int w, int h);
+
+/* Shorthands for a piece of row `y' from x1 to x2 inclusive
+ * and a piece of column `x' from y1 to y2 inclusive.
+ */
+#define projection_row_sum(P, Y, X1, X2)    projection_sum(P, X1, Y, (X2) - (X1) + 1, 1)
+#define projection_column_sum(P, X, Y1, Y2) projection_sum(P, X, Y1, 1, (Y2) - (Y1) + 1)
+
+
+#ifdef TESTING
+extern TestSuite projection_suite;
+#endif
+
+
+#endif
@@ -0,0 +1,292 @@
+/* Plasma OCR - an OCR engine
+ *
+ * ropetrie.c - a trie of rope step strings
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "common.h"
+#include "ropetrie.h"
+#include "editdist.h"
+#include <assert.h>
+#include <string.h>
+
+
+typedef struct
+{
+    char letter;            /* the last step of the node's string */
+    int parent;             /* -1 for the root */
+    int depth;              /* the length of the node's string */
+    int first_child, next_sibling;
+    int preorder, size;     /* the subtree is preorder..preorder+size-1 */
+} TrieNode;
+
+
+struct RopeTrieStruct
+{
+    int nodes_count, nodes_allocated;
+    TrieNode *nodes;        /* nodes[0] is the root */
+    int max_depth;
+    int finished;
+};
+
+
+static TrieNode *append_node(RopeTrie t)
+    LIST_APPEND(TrieNode, t->nodes, t->nodes_count, t->nodes_allocated)
+
+
+RopeTrie create_rope_trie(void)
+{
+    RopeTrie t = MALLOC1(struct RopeTrieStruct);
+    TrieNode *root;
+
+    LIST_CREATE(TrieNode, t->nodes, t->nodes_count, t->nodes_allocated, 64)
+    root = append_node(t);
+    root->letter = 0;
+    root->parent = -1;
+    root->depth = 0;
+    root->first_child = root->next_sibling = -1;
+    t->max_depth = 0;
+    t->finished = 0;
+    return t;
+}
+
+
+void free_rope_trie(RopeTrie t)
+{
+    FREE(t->nodes);
+    FREE1(t);
+}
+
+
+int rope_trie_add(RopeTrie t, const char *steps, int length)
+{
+    int node = 0;
+    int i;
+
+    assert(!t->finished);
+    for (i = 0; i < length; i++)
+    {
+        int child = t->nodes[node].first_child;
+        while (child != -1 && t->nodes[child].letter != steps[i])
+            child = t->nodes[child].next_sibling;
+
+        if (child == -1)
+        {
+            TrieNode *n = append_node(t);   /* may move the nodes */
+            child = t->nodes_count - 1;
+            n->letter = steps[i];
+            n->parent = node;
+            n->depth = i + 1;
+            n->first_child = -1;
+            n->next_sibling = t->nodes[node].first_child;
+            t->nodes[node].first_child = child;
+        }
+        node = child;
+    }
+
+    if (length > t->max_depth)
+        t->max_depth = length;
+    return node;
+}
+
+
+void finish_rope_trie(RopeTrie t)
+{
+    int *stack = MALLOC(int, t->nodes_count);
+    int top = 0;
+    int counter = 0;
+    int i;
+
+    /* number the nodes in preorder */
+    stack[top++] = 0;
+    while (top)
+    {
+        int node = stack[--top];
+        int child;
+
+        t->nodes[node].preorder = counter++;
+        for (child = t->nodes[node].first_child; child != -1;
+             child = t->nodes[child].next_sibling)
+        {
+            stack[top++] = child;
+        }
+    }
+
+    /* children come after their parents, so sizes can be summed backwards */
+    for (i = 0; i < t->nodes_count; i++)
+        t->nodes[i].size = 1;
+    for (i = t->nodes_count - 1; i > 0; i--)
+        t->nodes[t->nodes[i].parent].size += t->nodes[i].size;
+
+    FREE(stack);
+    t->finished = 1;
+}
+
+
+/* qsort() has no place for the context, and the search may run in several
+ * threads, so we sort pairs instead.
+ */
+typedef struct
+{
+    int preorder;
+    int index;
+} Entry;
+
+
+static int compare_entries(const void *p1, const void *p2)
+{
+    const Entry *e1 = (const Entry *) p1;
+    const Entry *e2 = (const Entry *) p2;
+    return e1->preorder - e2->preorder;
+}
+
+
+static int is_ancestor(const TrieNode *nodes, int a, int x)
+{
+    return nodes[x].preorder >= nodes[a].preorder
+        && nodes[x].preorder < nodes[a].preorder + nodes[a].size;
+}
+
+
+/* The terminals are visited in preorder, so consecutive ones share
+ * the longest possible part of the path, and its columns are reused.
+ */
+void rope_trie_search(RopeTrie t, int radius, const char *query, int query_length,
+                      int count, const int *terminals, int cutoff, int *results)
+{
+    const TrieNode *nodes = t->nodes;
+    int height = query_length + 1;
+    int *columns = MALLOC(int, (t->max_depth + 1) * height);
+    int *path = MALLOC(int, t->max_depth + 1);
+    Entry *entries = MALLOC(Entry, count);
+    int top = 0;            /* path[0..top] is the current path */
+    int dead = -1;          /* the depth of a dropped node on the path, or -1 */
+    int k;
+
+    assert(t->finished);
+
+    for (k = 0; k < count; k++)
+    {
+        entries[k].preorder = nodes[terminals[k]].preorder;
+        entries[k].index = k;
+    }
+    qsort(entries, count, sizeof(Entry), compare_entries);
+
+    path[0] = 0;
+    edit_distance_column(radius, query, query_length, 0, NULL, NULL, 0, 0, columns);
+
+    for (k = 0; k < count; k++)
+    {
+        int x = terminals[entries[k].index];
+        int depth = nodes[x].depth;
+        int node, j;
+
+        while (!is_ancestor(nodes, path[top], x))
+            top--;
+        if (dead > top)
+            dead = -1;
+
+        if (dead == -1)
+        {
+            /* extend the path down to x */
+            for (node = x, j = depth; j > top; j--, node = nodes[node].parent)
+                path[j] = node;
+
+            for (j = top + 1; j <= depth; j++)
+            {
+                int bound = edit_distance_column(radius, query, query_length, j,
+                                                 j > 1 ? columns + (j - 2) * height : NULL,
+                                                 columns + (j - 1) * height,
+                                                 j > 1 ? nodes[path[j - 1]].letter : 0,
+                                                 nodes[path[j]].letter,
+                                                 columns + j * height);
+                top = j;
+                if (bound > cutoff)
+                {
+                    dead = j;
+                    break;
+                }
+            }
+        }
+
+        if (dead == -1 && columns[depth * height + query_length] <= cutoff)
+            results[entries[k].index] = columns[depth * height + query_length];
+        else
+            results[entries[k].index] = cutoff + 1;
+    }
+
+    FREE(columns);
+    FREE(path);
+    FREE(entries);
+}
+
+
+/* ______________________________   testing   __________________________________ */
+
+#ifdef TESTING
+
+static void test_search(void)
+{
+    char strings[200][30];
+    int lengths[200], terminals[200], results[200];
+    char query[30];
+    RopeTrie t = create_rope_trie();
+    int n = 200;
+    int i, j, q;
+
+    srand(23);
+    for (i = 0; i < n; i++)
+    {
+        /* few letters and short strings, so that prefixes are shared */
+        lengths[i] = rand() % 30;
+        for (j = 0; j < lengths[i]; j++)
+            strings[i][j] = "2468"[rand() % (j < 5 ? 2 : 4)];
+        terminals[i] = rope_trie_add(t, strings[i], lengths[i]);
+    }
+    assert(rope_trie_add(t, strings[7], lengths[7]) == terminals[7]);
+    finish_rope_trie(t);
+
+    for (q = 0; q < 20; q++)
+    {
+        int length = rand() % 30;
+        int radius = rand() % 100;
+        int cutoff = q % 2 ? NO_CUTOFF : rand() % 400 - 200;
+
+        for (j = 0; j < length; j++)
+            query[j] = "2468"[rand() % 4];
+
+        rope_trie_search(t, radius, query, length, n, terminals, cutoff, results);
+        for (i = 0; i < n; i++)
+        {
+            int ed = edit_distance(radius, strings[i], lengths[i], query, length);
+            assert(results[i] == (ed <= cutoff ? ed : cutoff + 1));
+        }
+    }
+
+    free_rope_trie(t);
+}
+
+static TestFunction tests[] = {
+    test_search,
+    NULL
+};
+
+TestSuite ropetrie_suite = {"ropetrie", NULL, NULL, tests};
+
+#endif
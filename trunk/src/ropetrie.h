@@ -0,0 +1,63 @@
+/* Plasma OCR - an OCR engine
+ *
+ * ropetrie.h - a trie of rope step strings
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/* Library ropes share long prefixes, so instead of comparing a query rope
+ * with each of them from scratch, we put them all into a trie and walk it
+ * with edit_distance_column(): each trie node gets one column of the table,
+ * shared by all the ropes that go through it. A branch is dropped
+ * as soon as nothing below it can come within the cutoff.
+ */
+
+
+#ifndef PLASMA_OCR_ROPETRIE_H
+#define PLASMA_OCR_ROPETRIE_H
+
+
+typedef struct RopeTrieStruct *RopeTrie;
+
+
+RopeTrie create_rope_trie(void);
+void free_rope_trie(RopeTrie);
+
+/* Add a string; returns its terminal node. Equal strings get the same node.
+ * Must not be called after finish_rope_trie().
+ */
+int rope_trie_add(RopeTrie, const char *steps, int length);
+
+/* Prepare the trie for searching. */
+void finish_rope_trie(RopeTrie);
+
+/* For each k < count, compute
+ *     results[k] = edit_distance(radius, <string of terminals[k]>, query, query_length)
+ * if it's <= cutoff, otherwise cutoff + 1.
+ * Only the paths to the given terminals are walked.
+ * Reads the trie only, so it may be called from several threads at once.
+ */
+void rope_trie_search(RopeTrie, int radius, const char *query, int query_length,
+                      int count, const int *terminals, int cutoff, int *results);
+
+
+#ifdef TESTING
+extern TestSuite ropetrie_suite;
+#endif
+
+#endif
@@ -33,55 +33,57 @@
 #include "shiftcut.h"
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
-
-typedef unsigned char byte;
+#ifdef X86_KERNELS
+#   include <immintrin.h>
+#endif
 
 
-static int sum_column_gray(byte **pixels, int x, int y1, int y2)
-{
-    int sum = 0, y;
-    for (y = y1; y <= y2; y++) sum += 255 - pixels[y][x]; /* XXX */
-    return sum;
-}
-
+typedef unsigned char byte;
 
-static int sum_row_gray(byte *row, int x1, int x2)
-{
-    int sum = 0, x, n = x2 - x1;
-    byte *p = row + x1;
-    for (x = 0; x <= n; x++) sum += 255 - p[x]; /* XXX */
-    return sum;
-}
 
+/* The cut leaves the first `cut' rows (or columns) of the piece on one side.
+ * It's the last one before the half of the weight `a' is reached,
+ * and `weight(n)', the weight of the first n rows, grows with n,
+ * so we find it by bisection.
+ */
 
-static int sum_column_bw(byte **pixels, int x, int y1, int y2)
+static int find_hcut(Projection p, int a, int l, int t, int w, int h)
 {
-    int sum = 0, y;
-    for (y = y1; y <= y2; y++) if (pixels[y][x]) sum++;
-    return sum;
+    int lo = 1, hi = h;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) >> 1;
+        if ((projection_sum(p, l, t, w, mid) << 1) < a)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
 }
 
 
-static int sum_row_bw(byte *row, int x1, int x2)
+static int find_vcut(Projection p, int a, int l, int t, int w, int h)
 {
-    int sum = 0, x, n = x2 - x1;
-    byte *p = row + x1;
-    for (x = 0; x <= n; x++) if (p[x]) sum++;
-    return sum;
+    int lo = 1, hi = w;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) >> 1;
+        if ((projection_sum(p, l, t, mid, h) << 1) < a)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
 }
 
 
-static void make_vcut(int a, int l, int w, int h, byte **pixels,
-                      byte *sig, int k,
-                      int s_row(byte *, int, int),
-                      int s_col(byte **, int, int, int));
+static void make_vcut(Projection p, int a, int l, int t, int w, int h, byte *f, int k);
 
 
-static void make_hcut(int a, int l, int w, int h,
-                      byte **pixels, byte *f, int k,
-                      int s_row(byte *, int, int),
-                      int s_col(byte **, int, int, int))
+/* The piece is the w * h rectangle at (l, t) of the projection; its weight is `a'. */
+static void make_hcut(Projection p, int a, int l, int t, int w, int h, byte *f, int k)
 {
     int cut = 0; /* how many rows are in the top part */
     int up_weight = 0;
@@ -90,18 +92,13 @@ static void make_hcut(int a, int l, int w, int h,
 
     if (a)
     {
-        int last_row_weight = 0;
+        int last_row_weight;
 
         assert(w && h);
 
-        while ((up_weight << 1) < a)
-        {
-            last_row_weight = s_row(pixels[cut], l, l + w - 1);
-            up_weight += last_row_weight;
-            cut++;
-        }
-        cut--;
-        up_weight -= last_row_weight;
+        cut = find_hcut(p, a, l, t, w, h);
+        up_weight = projection_sum(p, l, t, w, cut);
+        last_row_weight = projection_row_sum(p, t + cut, l, l + w - 1);
         f[k] = (byte) ((256 *
                     (cut * w + w * ((a >> 1) - up_weight) / last_row_weight))
                  / (w * h));
@@ -117,15 +114,12 @@ static void make_hcut(int a, int l, int w, int h,
         f[k] = 128;
     }
 
-    make_vcut(up_weight, l, w, cut, pixels, f, k << 1, s_row, s_col);
-    make_vcut(a - up_weight, l, w, h - cut, pixels + cut, f, (k << 1) | 1, s_row, s_col);
+    make_vcut(p, up_weight, l, t, w, cut, f, k << 1);
+    make_vcut(p, a - up_weight, l, t + cut, w, h - cut, f, (k << 1) | 1);
 }
 
 
-static void make_vcut(int a, int l, int w, int h,
-                      byte **pixels, byte *f, int k,
-                      int s_row(byte *, int, int),
-                      int s_col(byte **, int, int, int))
+static void make_vcut(Projection p, int a, int l, int t, int w, int h, byte *f, int k)
 {
     int cut = 0;          /* how many columns are in the left part */
     int left_weight = 0;
@@ -134,18 +128,13 @@ static void make_vcut(int a, int l, int w, int h,
 
     if (a)
     {
-        int last_col_weight = 0;
+        int last_col_weight;
 
         assert(w && h);
 
-        while ((left_weight << 1) < a)
-        {
-            last_col_weight = s_col(pixels, l + cut, 0, h-1);
-            left_weight += last_col_weight;
-            cut++;
-        }
-        cut--;
-        left_weight -= last_col_weight;
+        cut = find_vcut(p, a, l, t, w, h);
+        left_weight = projection_sum(p, l, t, cut, h);
+        last_col_weight = projection_column_sum(p, l + cut, t, t + h - 1);
         f[k] = (byte) ((256 *
                     (cut * h + h * ((a >> 1) - left_weight) / last_col_weight))
                  / (w * h));
@@ -160,36 +149,34 @@ static void make_vcut(int a, int l, int w, int h,
         f[k] = 128;
     }
 
-    make_hcut(left_weight, l, cut, h, pixels, f, k << 1, s_row, s_col);
-    make_hcut(a - left_weight, l + cut, w - cut, h, pixels, f, (k << 1) | 1, s_row, s_col);
+    make_hcut(p, left_weight, l, t, cut, h, f, k << 1);
+    make_hcut(p, a - left_weight, l + cut, t, w - cut, h, f, (k << 1) | 1);
 }
 
 
-static void get_fingerprint(int width, int height, byte **pixels, Fingerprint *f,
-            int s_row(byte *, int, int),
-            int s_col(byte **, int, int, int))
+void get_fingerprint_in_projection(Projection p, int x, int y, int w, int h,
+                                   Fingerprint *result)
 {
-    int area = 0, i;
-    
-    for (i = 0; i < height; i++)
-    {
-        area += s_row(pixels[i], 0, width - 1);
-    }
+    int area = projection_sum(p, x, y, w, h);
     assert(area >= 0);
 
-    make_hcut(area, 0, width, height, pixels, ((unsigned char *) *f) - 1, 1, s_row, s_col);
+    make_hcut(p, area, x, y, w, h, ((unsigned char *) *result) - 1, 1);
 }
 
 
 void get_fingerprint_gray(unsigned char **data, int w, int h, Fingerprint *result)
 {
-    get_fingerprint(w, h, data, result, sum_row_gray, sum_column_gray);
+    Projection p = create_projection_gray(data, 0, 0, w, h);
+    get_fingerprint_in_projection(p, 0, 0, w, h, result);
+    free_projection(p);
 }
 
 
 void get_fingerprint_bw(unsigned char **data, int w, int h, Fingerprint *result)
 {
-    get_fingerprint(w, h, data, result, sum_row_bw, sum_column_bw);
+    Projection p = create_projection_bw(data, 0, 0, w, h);
+    get_fingerprint_in_projection(p, 0, 0, w, h, result);
+    free_projection(p);
 }
 
 
@@ -207,3 +194,263 @@ long fingerprint_distance_squared(Fingerprint f1, Fingerprint f2)
     assert(s >= 0);
     return s;
 }
+
+
+long fingerprint_distance_squared_coarse(Fingerprint f1, Fingerprint f2, int levels)
+{
+    int i, n = FINGERPRINT_LEVEL_SIZE(levels);
+    long s = 0;
+
+    assert(levels >= 0 && levels <= FINGERPRINT_LEVELS);
+    for (i = 0; i < n; i++)
+    {
+        long difference = f1[i] - f2[i];
+        s += difference * difference;
+    }
+
+    return s;
+}
+
+
+long fingerprint_distance_squared_bounded(Fingerprint f1, Fingerprint f2, long bound)
+{
+    int i = 0, level;
+    long s = 0;
+
+    /* level 1 is a single byte, too little to bother checking */
+    for (level = 2; level <= FINGERPRINT_LEVELS; level++)
+    {
+        int n = FINGERPRINT_LEVEL_SIZE(level);
+        for (; i < n; i++)
+        {
+            long difference = f1[i] - f2[i];
+            s += difference * difference;
+        }
+        if (s > bound)
+            return s;
+    }
+
+    return s;
+}
+
+
+/* ______________________________   batch distances   __________________________________ */
+
+
+static void distances_generic(byte *query, Fingerprint *fingerprints, int count, long *result)
+{
+    int i;
+    for (i = 0; i < count; i++)
+        result[i] = fingerprint_distance_squared(query, fingerprints[i]);
+}
+
+
+#ifdef X86_KERNELS
+
+/* A fingerprint is 31 bytes, so we load it as bytes 0..15 and 15..30
+ * and clear the overlapping byte in the second half.
+ * Differences fit into 16 bits, pairwise sums of squares into 32.
+ */
+
+__attribute__((target("sse2")))
+static void distances_sse2(byte *query, Fingerprint *fingerprints, int count, long *result)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i mask = _mm_slli_si128(_mm_set1_epi8(-1), 1);
+    __m128i q1 = _mm_loadu_si128((__m128i *) query);
+    __m128i q2 = _mm_and_si128(_mm_loadu_si128((__m128i *) (query + 15)), mask);
+    __m128i q1l = _mm_unpacklo_epi8(q1, zero);
+    __m128i q1h = _mm_unpackhi_epi8(q1, zero);
+    __m128i q2l = _mm_unpacklo_epi8(q2, zero);
+    __m128i q2h = _mm_unpackhi_epi8(q2, zero);
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        byte *f = fingerprints[i];
+        __m128i f1 = _mm_loadu_si128((__m128i *) f);
+        __m128i f2 = _mm_and_si128(_mm_loadu_si128((__m128i *) (f + 15)), mask);
+        __m128i d1l = _mm_sub_epi16(_mm_unpacklo_epi8(f1, zero), q1l);
+        __m128i d1h = _mm_sub_epi16(_mm_unpackhi_epi8(f1, zero), q1h);
+        __m128i d2l = _mm_sub_epi16(_mm_unpacklo_epi8(f2, zero), q2l);
+        __m128i d2h = _mm_sub_epi16(_mm_unpackhi_epi8(f2, zero), q2h);
+        __m128i s = _mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(d1l, d1l),
+                                                _mm_madd_epi16(d1h, d1h)),
+                                  _mm_add_epi32(_mm_madd_epi16(d2l, d2l),
+                                                _mm_madd_epi16(d2h, d2h)));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+        result[i] = _mm_cvtsi128_si32(s);
+    }
+}
+
+
+__attribute__((target("avx2")))
+static void distances_avx2(byte *query, Fingerprint *fingerprints, int count, long *result)
+{
+    __m128i mask = _mm_slli_si128(_mm_set1_epi8(-1), 1);
+    __m256i q1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) query));
+    __m256i q2 = _mm256_cvtepu8_epi16(
+                    _mm_and_si128(_mm_loadu_si128((__m128i *) (query + 15)), mask));
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        byte *f = fingerprints[i];
+        __m256i d1 = _mm256_sub_epi16(
+                        _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) f)), q1);
+        __m256i d2 = _mm256_sub_epi16(_mm256_cvtepu8_epi16(
+                        _mm_and_si128(_mm_loadu_si128((__m128i *) (f + 15)), mask)), q2);
+        __m256i s8 = _mm256_add_epi32(_mm256_madd_epi16(d1, d1), _mm256_madd_epi16(d2, d2));
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(s8),
+                                  _mm256_extracti128_si256(s8, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+        result[i] = _mm_cvtsi128_si32(s);
+    }
+}
+
+#endif /* X86_KERNELS */
+
+
+void fingerprint_distances_squared(Fingerprint query, Fingerprint *fingerprints,
+                                   int count, long *result)
+{
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        distances_avx2(query, fingerprints, count, result);
+        return;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        distances_sse2(query, fingerprints, count, result);
+        return;
+    }
+#endif
+    distances_generic(query, fingerprints, count, result);
+}
+
+
+/* ______________________________   testing   __________________________________ */
+
+#ifdef TESTING
+
+static void check_kernel(void (*kernel)(byte *, Fingerprint *, int, long *))
+{
+    int n = 100;
+    Fingerprint *f = MALLOC(Fingerprint, n);
+    long *expected = MALLOC(long, n);
+    long *actual = MALLOC(long, n);
+    Fingerprint q;
+    int i, j;
+
+    srand(31);
+    for (i = 0; i < n; i++)
+        for (j = 0; j < (int) sizeof(Fingerprint); j++)
+            f[i][j] = rand() % 256;
+
+    /* extreme values too */
+    memset(f[0], 255, sizeof(Fingerprint));
+    memset(q, 0, sizeof(Fingerprint));
+
+    for (i = 0; i < 2; i++)
+    {
+        distances_generic(q, f, n, expected);
+        kernel(q, f, n, actual);
+        for (j = 0; j < n; j++)
+            assert(actual[j] == expected[j]);
+        memcpy(q, f[n / 2], sizeof(Fingerprint));
+    }
+
+    FREE(f);
+    FREE(expected);
+    FREE(actual);
+}
+
+static void test_batch_distances(void)
+{
+    check_kernel(fingerprint_distances_squared);
+#ifdef X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        check_kernel(distances_sse2);
+    if (__builtin_cpu_supports("avx2"))
+        check_kernel(distances_avx2);
+#endif
+}
+
+/* A window of a projection gets the same fingerprint as a separate bitmap. */
+static void test_window(void)
+{
+    int w = 23, h = 17;
+    unsigned char **pixels = MALLOC(unsigned char *, h);
+    unsigned char **window = MALLOC(unsigned char *, h - 4);
+    Projection p;
+    Fingerprint f1, f2;
+    int i, j;
+
+    srand(17);
+    for (i = 0; i < h; i++)
+    {
+        pixels[i] = MALLOC(unsigned char, w);
+        for (j = 0; j < w; j++)
+            pixels[i][j] = rand() % 3 ? 0 : 1 + rand() % 255;
+    }
+    for (i = 0; i < h - 4; i++)
+        window[i] = pixels[i + 3] + 5;
+
+    p = create_projection_bw(pixels, 0, 0, w, h);
+    get_fingerprint_in_projection(p, 5, 3, w - 7, h - 4, &f1);
+    get_fingerprint_bw(window, w - 7, h - 4, &f2);
+    assert(!memcmp(f1, f2, sizeof(Fingerprint)));
+    free_projection(p);
+
+    p = create_projection_gray(pixels, 0, 0, w, h);
+    get_fingerprint_in_projection(p, 5, 3, w - 7, h - 4, &f1);
+    get_fingerprint_gray(window, w - 7, h - 4, &f2);
+    assert(!memcmp(f1, f2, sizeof(Fingerprint)));
+    free_projection(p);
+
+    for (i = 0; i < h; i++)
+        FREE(pixels[i]);
+    FREE(pixels);
+    FREE(window);
+}
+
+static void test_bounded(void)
+{
+    Fingerprint f1, f2;
+    int i, j;
+
+    srand(5);
+    for (i = 0; i < 1000; i++)
+    {
+        long d, bound = rand() % 20000;
+        for (j = 0; j < (int) sizeof(Fingerprint); j++)
+        {
+            f1[j] = rand() % 256;
+            f2[j] = f1[j] + rand() % 64 - 32;
+        }
+        d = fingerprint_distance_squared(f1, f2);
+        for (j = 0; j <= FINGERPRINT_LEVELS; j++)
+            assert(fingerprint_distance_squared_coarse(f1, f2, j) <= d);
+        assert(fingerprint_distance_squared_coarse(f1, f2, FINGERPRINT_LEVELS) == d);
+        if (d <= bound)
+            assert(fingerprint_distance_squared_bounded(f1, f2, bound) == d);
+        else
+            assert(fingerprint_distance_squared_bounded(f1, f2, bound) > bound);
+    }
+}
+
+static TestFunction tests[] = {
+    test_batch_distances,
+    test_window,
+    test_bounded,
+    NULL
+};
+
+TestSuite shiftcut_suite = {"shiftcut", NULL, NULL, tests};
+
+#endif
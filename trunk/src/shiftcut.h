@@ -24,10 +24,47 @@
 #define PLASMA_OCR_SHIFTCUT_H
 
 
-typedef unsigned char Fingerprint[31];
+#include "projection.h"
+
+
+/* The cuts are stored level by level: byte k - 1 holds the cut number k,
+ * and the cuts 2k and 2k + 1 split the two parts made by the cut k.
+ * So the first 1, 3, 7 and 15 bytes are fingerprints too, only coarser,
+ * and a distance between them is a lower bound of the full distance.
+ * Pattern files always had this layout.
+ */
+#define FINGERPRINT_LEVELS 5
+#define FINGERPRINT_LEVEL_SIZE(LEVELS) ((1 << (LEVELS)) - 1)
+
+typedef unsigned char Fingerprint[FINGERPRINT_LEVEL_SIZE(FINGERPRINT_LEVELS)];
 
 void get_fingerprint_bw(unsigned char **, int w, int h, Fingerprint *result);
 void get_fingerprint_gray(unsigned char **, int w, int h, Fingerprint *result);
+
+/* The fingerprint of the w * h window at (x, y) of a projection.
+ * Several windows of one image can share the projection.
+ */
+void get_fingerprint_in_projection(Projection, int x, int y, int w, int h,
+                                   Fingerprint *result);
+
 long fingerprint_distance_squared(Fingerprint f1, Fingerprint f2);
 
+/* The distance between the first `levels' levels of the fingerprints. */
+long fingerprint_distance_squared_coarse(Fingerprint f1, Fingerprint f2, int levels);
+
+/* The exact distance if it's at most `bound', otherwise some value above `bound'.
+ * Looks at 3, 7 and 15 bytes first, and most far fingerprints stop there.
+ */
+long fingerprint_distance_squared_bounded(Fingerprint f1, Fingerprint f2, long bound);
+
+/* Compute fingerprint_distance_squared() from `query' to `count'
+ * fingerprints at once, using SIMD where the CPU has it.
+ */
+void fingerprint_distances_squared(Fingerprint query, Fingerprint *fingerprints,
+                                   int count, long *result);
+
+#ifdef TESTING
+extern TestSuite shiftcut_suite;
+#endif
+
 #endif
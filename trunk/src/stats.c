@@ -0,0 +1,186 @@
+/* Plasma OCR - an OCR engine
+ *
+ * stats.c - counters and timers for the recognition pipeline
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "common.h"
+#include "stats.h"
+
+#ifdef PLASMA_STATS
+
+#include <pthread.h>
+#include <time.h>
+
+
+typedef struct StatsBlockStruct StatsBlock;
+
+struct StatsBlockStruct
+{
+    unsigned long counts[STATS_COUNT];
+    double nanoseconds[STATS_COUNT];
+    StatsBlock *next;
+};
+
+
+static const char *names[STATS_COUNT] = {
+    "library_load",
+    "create_pattern",
+    "skeletonize",
+    "chaincode",
+    "cut_word",
+    "match_patterns",
+    "compare_patterns",
+    "edit_distance",
+    "shiftcut",
+    "candidates",
+    "pruned_by_topology",
+    "matches",
+    "pruned_by_bound",
+    "cache_hits",
+    "cache_misses",
+    "ed_cache_hits",
+    "ed_cache_misses"
+};
+
+/* stages before this one are timed */
+#define FIRST_COUNTER STAT_CANDIDATES
+
+
+static __thread StatsBlock *local_block;
+static StatsBlock *all_blocks;
+static pthread_mutex_t blocks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+static StatsBlock *get_local_block(void)
+{
+    StatsBlock *b = local_block;
+    int i;
+
+    if (b)
+        return b;
+
+    b = MALLOC1(StatsBlock);
+    for (i = 0; i < STATS_COUNT; i++)
+    {
+        b->counts[i] = 0;
+        b->nanoseconds[i] = 0;
+    }
+    pthread_mutex_lock(&blocks_mutex);
+    b->next = all_blocks;
+    all_blocks = b;
+    pthread_mutex_unlock(&blocks_mutex);
+
+    local_block = b;
+    return b;
+}
+
+
+void stats_add(StatsId id, unsigned long count)
+{
+    get_local_block()->counts[id] += count;
+}
+
+
+double stats_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+
+void stats_add_time(StatsId id, double nanoseconds)
+{
+    StatsBlock *b = get_local_block();
+    b->counts[id]++;
+    b->nanoseconds[id] += nanoseconds;
+}
+
+
+static void sum_blocks(unsigned long *counts, double *nanoseconds)
+{
+    StatsBlock *b;
+    int i;
+
+    for (i = 0; i < STATS_COUNT; i++)
+    {
+        counts[i] = 0;
+        nanoseconds[i] = 0;
+    }
+
+    pthread_mutex_lock(&blocks_mutex);
+    for (b = all_blocks; b; b = b->next)
+    {
+        for (i = 0; i < STATS_COUNT; i++)
+        {
+            counts[i] += b->counts[i];
+            nanoseconds[i] += b->nanoseconds[i];
+        }
+    }
+    pthread_mutex_unlock(&blocks_mutex);
+}
+
+
+void stats_print(FILE *f)
+{
+    unsigned long counts[STATS_COUNT];
+    double nanoseconds[STATS_COUNT];
+    int i;
+
+    sum_blocks(counts, nanoseconds);
+
+    fprintf(f, "%-20s %12s %12s %12s\n", "stage", "calls", "total ms", "avg us");
+    for (i = 0; i < FIRST_COUNTER; i++)
+    {
+        fprintf(f, "%-20s %12lu %12.3f %12.3f\n", names[i], counts[i],
+                nanoseconds[i] / 1e6,
+                counts[i] ? nanoseconds[i] / counts[i] / 1e3 : 0.);
+    }
+    fprintf(f, "\n");
+    for (i = FIRST_COUNTER; i < STATS_COUNT; i++)
+        fprintf(f, "%-20s %12lu\n", names[i], counts[i]);
+}
+
+
+void stats_print_json(FILE *f)
+{
+    unsigned long counts[STATS_COUNT];
+    double nanoseconds[STATS_COUNT];
+    int i;
+
+    sum_blocks(counts, nanoseconds);
+
+    fprintf(f, "{\n    \"stages\": {\n");
+    for (i = 0; i < FIRST_COUNTER; i++)
+    {
+        fprintf(f, "        \"%s\": {\"calls\": %lu, \"ns\": %.0f}%s\n",
+                names[i], counts[i], nanoseconds[i],
+                i == FIRST_COUNTER - 1 ? "" : ",");
+    }
+    fprintf(f, "    },\n    \"counters\": {\n");
+    for (i = FIRST_COUNTER; i < STATS_COUNT; i++)
+    {
+        fprintf(f, "        \"%s\": %lu%s\n", names[i], counts[i],
+                i == STATS_COUNT - 1 ? "" : ",");
+    }
+    fprintf(f, "    }\n}\n");
+}
+
+#endif /* PLASMA_STATS */
@@ -0,0 +1,94 @@
+/* Plasma OCR - an OCR engine
+ *
+ * stats.h - counters and timers for the recognition pipeline
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/* Statistics are only collected when compiled with PLASMA_STATS
+ * (`make STATS=y'); otherwise the macros below expand to nothing
+ * or to the bare statement.
+ *
+ * Each thread counts into its own block, so there's no locking
+ * on the hot path. The blocks are summed up when printing,
+ * which should be done after all the threads have finished.
+ */
+
+
+#ifndef PLASMA_OCR_STATS_H
+#define PLASMA_OCR_STATS_H
+
+
+#include <stdio.h>
+
+
+typedef enum
+{
+    /* timed stages (each one is also counted) */
+    STAT_LIBRARY_LOAD,
+    STAT_CREATE_PATTERN,
+    STAT_SKELETONIZE,
+    STAT_CHAINCODE,
+    STAT_CUT_WORD,
+    STAT_MATCH_PATTERNS,
+    STAT_COMPARE_PATTERNS,
+    STAT_EDIT_DISTANCE,
+    STAT_SHIFTCUT,
+
+    /* plain counters */
+    STAT_CANDIDATES,            /* library patterns a query could be matched to */
+    STAT_PRUNED_BY_TOPOLOGY,    /* ...and were skipped by the topology index */
+    STAT_MATCHES,               /* passed match_patterns() */
+    STAT_PRUNED_BY_BOUND,       /* ...but were never compared thanks to lower bounds */
+    STAT_CACHE_HITS,
+    STAT_CACHE_MISSES,
+    STAT_ED_CACHE_HITS,         /* edit distances found in their cache */
+    STAT_ED_CACHE_MISSES,
+
+    STATS_COUNT
+} StatsId;
+
+
+#ifdef PLASMA_STATS
+
+void stats_add(StatsId, unsigned long count);
+double stats_now(void);     /* in nanoseconds */
+void stats_add_time(StatsId, double nanoseconds);
+
+void stats_print(FILE *);
+void stats_print_json(FILE *);
+
+#   define STATS_ADD(ID, N) stats_add(ID, N)
+#   define STATS_TIME(ID, STATEMENT)                        \
+    do {                                                    \
+        double stats_start_ = stats_now();                  \
+        STATEMENT;                                          \
+        stats_add_time(ID, stats_now() - stats_start_);     \
+    } while (0)
+
+#else
+
+#   define STATS_ADD(ID, N)
+#   define STATS_TIME(ID, STATEMENT) STATEMENT
+
+#endif
+
+#define STATS_COUNT_ONE(ID) STATS_ADD(ID, 1)
+
+
+#endif
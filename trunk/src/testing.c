@@ -5,10 +5,18 @@
 #include <stdio.h>
 #include <unistd.h>
 #include "bitmaps.h"
+#include "cache.h"
 #include "chaincode.h"
+#include "cluster.h"
 #include "editdist.h"
 #include "pattern.h"
+#include "pqindex.h"
 #include "io.h"
+#include "projection.h"
+#include "ropetrie.h"
+#include "thinning.h"
+#include "topology.h"
+#include "vptree.h"
 
 
 /* This test is useless - its success is guaranteed by the language standard.
@@ -28,10 +36,19 @@ static TestSuite basic_suite = {"Basic", NULL, NULL, basic_tests};
 
 static TestSuite *suites[] = {&basic_suite,
                               &bitmaps_suite,
+                              &cache_suite,
                               &chaincode_suite,
+                              &cluster_suite,
                               &editdist_suite,
                               &io_suite,
                               &pattern_suite,
+                              &pqindex_suite,
+                              &projection_suite,
+                              &ropetrie_suite,
+                              &shiftcut_suite,
+                              &thinning_suite,
+                              &topology_suite,
+                              &vptree_suite,
                               NULL};
 
 
@@ -22,8 +22,10 @@
 
 #include "bitmaps.h"
 #include "thinning.h"
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 
 /* Indices into tables are donuts of 8 bits
@@ -38,22 +40,20 @@
  * and all of their reflections and mirrorings. `?' is a wildcard.
  */
 
-static unsigned char mark_table[32] = {
-    127, 127, 255, 255, 127, 127, 255, 204,
-     63,  15, 255,  12,  63,  15, 255,  12,
-    119, 119, 255, 255,  85,  85,  68,  68,
-    127, 127, 255, 255, 127, 127, 255, 204
-};
+#define MARK_TABLE(B) \
+    B(127) B(127) B(255) B(255) B(127) B(127) B(255) B(204) \
+    B( 63) B( 15) B(255) B( 12) B( 63) B( 15) B(255) B( 12) \
+    B(119) B(119) B(255) B(255) B( 85) B( 85) B( 68) B( 68) \
+    B(127) B(127) B(255) B(255) B(127) B(127) B(255) B(204)
 
 
 /* The sweep table gives 1 for the first 4 of 5 donut types shown for the mark table.
  */
-static unsigned char sweep_table[32] = {
-     51,  51, 204, 204,  51,  51, 204, 204,
-     12,  12, 255,  12,  12,  12, 255,  12,
-     68,  68, 255, 255,  68,  68,  68,  68,
-    127, 127, 255, 255, 127, 127, 255, 204
-};
+#define SWEEP_TABLE(B) \
+    B( 51) B( 51) B(204) B(204) B( 51) B( 51) B(204) B(204) \
+    B( 12) B( 12) B(255) B( 12) B( 12) B( 12) B(255) B( 12) \
+    B( 68) B( 68) B(255) B(255) B( 68) B( 68) B( 68) B( 68) \
+    B(127) B(127) B(255) B(255) B(127) B(127) B(255) B(204)
 
 
 /* The final touch table returns 0 only on donuts of this type:
@@ -63,12 +63,11 @@ static unsigned char sweep_table[32] = {
  *  ?00
  *
  */
-static unsigned char final_touch_table[32] = {
-    255, 255, 255, 255, 255, 255, 255, 255,
-    243, 243, 238, 255, 255, 255, 238, 255,
-    187, 255, 252, 252, 187, 255, 255, 255,
-    255, 255, 255, 255, 255, 255, 255, 255,
-};
+#define FINAL_TOUCH_TABLE(B) \
+    B(255) B(255) B(255) B(255) B(255) B(255) B(255) B(255) \
+    B(243) B(243) B(238) B(255) B(255) B(255) B(238) B(255) \
+    B(187) B(255) B(252) B(252) B(187) B(255) B(255) B(255) \
+    B(255) B(255) B(255) B(255) B(255) B(255) B(255) B(255)
 
 
 /* Tables are organized as follows.
@@ -81,8 +80,23 @@ static unsigned char final_touch_table[32] = {
  *
  * It is an index to the table.
  * The table says 1 iff table[EDCBA] & (1 << FGH) is nonzero.
+ *
+ * The same bits are also spread into tables of 256 bytes (0 or 1),
+ * indexed by EDCBAFGH, for the rolling kernel (see below).
  */
 
+#define TABLE_BYTE(B) B,
+#define TABLE_BITS(B) (B) & 1, (B) >> 1 & 1, (B) >> 2 & 1, (B) >> 3 & 1, \
+                      (B) >> 4 & 1, (B) >> 5 & 1, (B) >> 6 & 1, (B) >> 7 & 1,
+
+static unsigned char mark_table[32] = { MARK_TABLE(TABLE_BYTE) };
+static unsigned char sweep_table[32] = { SWEEP_TABLE(TABLE_BYTE) };
+static unsigned char final_touch_table[32] = { FINAL_TOUCH_TABLE(TABLE_BYTE) };
+
+static const unsigned char mark_bytes[256] = { MARK_TABLE(TABLE_BITS) };
+static const unsigned char sweep_bytes[256] = { SWEEP_TABLE(TABLE_BITS) };
+static const unsigned char final_touch_bytes[256] = { FINAL_TOUCH_TABLE(TABLE_BITS) };
+
 static int get_table_value(unsigned char *table, unsigned char **prow, int x)
 {
     int i, shift;
@@ -177,21 +191,26 @@ static void force_8_connectivity(unsigned char **pixels, int w, int h)
 }
 
 
-int peel(unsigned char **pixels, unsigned char **buffer, int w, int h)
+static int peel_bytes(unsigned char **pixels, unsigned char **buffer, int w, int h)
 {
     mark(pixels, buffer, w, h);
     return sweep(pixels, buffer, w, h);
 }
 
 
-unsigned char **thin(unsigned char **pixels, int w, int h, int N)
+/* peel() or peel_bytes(), for thin() and thicken() */
+typedef int (*PeelFunction)(unsigned char **pixels, unsigned char **buffer, int w, int h);
+
+
+static unsigned char **thin_with(PeelFunction peel_function,
+                                 unsigned char **pixels, int w, int h, int N)
 {
     unsigned char **result = provide_margins(pixels, w, h, /* make_it_0_or_1: */ 1);
     unsigned char **buffer = allocate_bitmap(w, h);
 
     while (N--)
     {
-        if (!peel(result, buffer, w, h))
+        if (!peel_function(result, buffer, w, h))
             break;
     }
     
@@ -200,9 +219,627 @@ unsigned char **thin(unsigned char **pixels, int w, int h, int N)
 }
 
 
+unsigned char **thin(unsigned char **pixels, int w, int h, int N)
+{
+    return thin_with(peel, pixels, w, h, N);
+}
+
+
+/* ______________________________   rolling thinning   __________________________________ */
+
+
+/* The same mark, sweep and final touch, but the donut index EDCBAFGH
+ * is carried along the row instead of being collected anew at each pixel.
+ * Going one pixel to the right, B and G become A and F, C and H become B and G,
+ * so only C and H are read from the other rows. D and E come from the row itself
+ * and are kept in variables: E is the next pixel, D is the pixel we've just left
+ * (as it is after the sweep). The bitmap must have margins and be 0/1;
+ * the margins may be black, as in thicken().
+ */
+
+#define ROLL_A 0x08
+#define ROLL_B 0x10
+#define ROLL_D 0x40
+#define ROLL_F 0x04
+#define ROLL_G 0x02
+
+/* The donut at -1, as far as the donut at 0 needs it. */
+#define ROLL_START(UP, DOWN) \
+    (((UP)[-1] << 4) | ((UP)[0] << 5) | ((DOWN)[-1] << 1) | (DOWN)[0])
+
+/* The donut at X without D and E. */
+#define ROLL_NEXT(D, UP, DOWN, X) \
+    ((((D) >> 1) & (ROLL_A | ROLL_B)) | (((D) << 1) & (ROLL_F | ROLL_G)) \
+     | ((UP)[(X) + 1] << 5) | (DOWN)[(X) + 1])
+
+
+/* Mark and sweep don't care about white pixels, so a word of white pixels
+ * in the row is skipped at once, and the donut is started anew after it.
+ */
+#define ROLL_CHUNK ((int) sizeof(unsigned long))
+
+static int chunk_is_white(unsigned char *p)
+{
+    unsigned long chunk;
+    memcpy(&chunk, p, sizeof(chunk));
+    return !chunk;
+}
+
+
+static void mark_rolling(unsigned char **pixels, unsigned char **candidates, int w, int h)
+{
+    int x, y;
+
+    for (y = 0; y < h; y++)
+    {
+        unsigned char *up = pixels[y - 1], *row = pixels[y], *down = pixels[y + 1];
+        unsigned char *candidates_row = candidates[y];
+        int d = ROLL_START(up, down);
+        int left = row[-1], center = row[0];
+
+        for (x = 0; x < w; )
+        {
+            int end = x + ROLL_CHUNK;
+
+            if (end > w)
+                end = w;
+            else if (chunk_is_white(row + x))
+            {
+                x = end;
+                d = ROLL_START(up + x, down + x);
+                left = 0;
+                center = row[x];
+                continue;
+            }
+
+            for (; x < end; x++)
+            {
+                int right = row[x + 1];
+                d = ROLL_NEXT(d, up, down, x);
+                candidates_row[x] = mark_bytes[d | (left << 6) | (right << 7)];
+                left = center;
+                center = right;
+            }
+        }
+    }
+}
+
+
+/* A deletion changes D of the next pixel, and nothing else in the row.
+ * So both sweep table values (for D = 0 and 1) are looked up in advance
+ * and then one of them is picked, keeping table loads off the chain
+ * of pixels depending on each other.
+ */
+static int sweep_rolling(unsigned char **pixels, unsigned char **candidates, int w, int h)
+{
+    int x, y;
+    int result = 0;
+
+    for (y = 0; y < h; y++)
+    {
+        unsigned char *up = pixels[y - 1], *row = pixels[y], *down = pixels[y + 1];
+        unsigned char *candidates_row = candidates[y];
+        int d = ROLL_START(up, down);
+        int left = row[-1], center = row[0];
+
+        for (x = 0; x < w; )
+        {
+            int end = x + ROLL_CHUNK;
+
+            if (end > w)
+                end = w;
+            else if (chunk_is_white(row + x))
+            {
+                x = end;
+                d = ROLL_START(up + x, down + x);
+                left = 0;
+                center = row[x];
+                continue;
+            }
+
+            for (; x < end; x++)
+            {
+                int right = row[x + 1];
+                int both, deleted;
+
+                d = ROLL_NEXT(d, up, down, x) | (right << 7);
+                both = sweep_bytes[d] | (sweep_bytes[d | ROLL_D] << 1);
+                deleted = center & (candidates_row[x] ^ 1) & ((both >> left) ^ 1);
+                center ^= deleted;
+                row[x] = (unsigned char) center;
+                result |= deleted;
+                left = center;
+                center = right;
+            }
+        }
+    }
+    return result;
+}
+
+
+static void force_8_connectivity_rolling(unsigned char **pixels, int w, int h)
+{
+    int x, y;
+
+    for (y = 0; y < h; y++)
+    {
+        unsigned char *up = pixels[y - 1], *row = pixels[y], *down = pixels[y + 1];
+        int d = ROLL_START(up, down);
+        int left = row[-1], center = row[0];
+
+        for (x = 0; x < w; x++)
+        {
+            int right = row[x + 1];
+            d = ROLL_NEXT(d, up, down, x);
+            center &= final_touch_bytes[d | (left << 6) | (right << 7)];
+            row[x] = (unsigned char) center;
+            left = center;
+            center = right;
+        }
+    }
+}
+
+
 /* (see thinning.h) */
-unsigned char **skeletonize_internal(unsigned char **pixels, int w, int h,
-                                     int use_8_connectivity, int make_it_0_or_1)
+int peel(unsigned char **pixels, unsigned char **buffer, int w, int h)
+{
+    mark_rolling(pixels, buffer, w, h);
+    return sweep_rolling(pixels, buffer, w, h);
+}
+
+
+static unsigned char **skeletonize_rolling(unsigned char **pixels, int w, int h,
+                                           int use_8_connectivity)
+{
+    unsigned char **buffer = provide_margins(pixels, w, h, 1);
+    unsigned char **candidates = allocate_bitmap(w, h);
+
+    while (peel(buffer, candidates, w, h)) {}
+
+    if (use_8_connectivity)
+        force_8_connectivity_rolling(buffer, w, h);
+
+    free_bitmap(candidates);
+    return buffer;
+}
+
+
+/* ______________________________   bit-packed thinning   __________________________________ */
+
+
+/* Here a bitmap keeps a pixel per bit, and a table is evaluated
+ * on a whole word of pixels at once. For that, each table is turned
+ * into a decision diagram over the 8 donut bits (see build_program());
+ * a node of the diagram costs a few boolean operations per word.
+ *
+ * Mark is independent for all pixels. Sweep and the final touch clean
+ * pixels in place, and a pixel sees the new state of its left neighbor.
+ * So the word is evaluated twice, with the left neighbors all white
+ * and all black, and only the pixels whose fate depends on that
+ * are resolved one by one, from left to right.
+ */
+
+
+typedef unsigned long Word;
+
+#define WORD_BITS ((int) (sizeof(Word) * 8))
+
+/* Donut bits in the order of the table index (see get_table_value()). */
+enum {DONUT_A, DONUT_B, DONUT_C, DONUT_D, DONUT_E, DONUT_F, DONUT_G, DONUT_H, DONUT_BITS};
+
+/* A diagram of 8 variables can't have more nodes than this. */
+#define MAX_PROGRAM_SIZE 512
+
+
+/* Node 0 is constant 0, node 1 is constant 1.
+ * Other nodes mean `var ? hi : lo' and come after their children.
+ */
+typedef struct
+{
+    int count;
+    int root;
+    unsigned char var[MAX_PROGRAM_SIZE];
+    short lo[MAX_PROGRAM_SIZE], hi[MAX_PROGRAM_SIZE];
+} Program;
+
+
+static Program mark_program, sweep_program, final_touch_program;
+static pthread_once_t programs_once = PTHREAD_ONCE_INIT;
+
+
+static int table_bit(unsigned char *table, int donut)
+{
+    int shift = ((donut >> DONUT_F) & 1) << 2
+              | ((donut >> DONUT_G) & 1) << 1
+              | ((donut >> DONUT_H) & 1);
+    return (table[donut & 31] >> shift) & 1;
+}
+
+
+/* The function of the variables 0..level-1 whose truth table
+ * is donuts `offset'..`offset + 2^level - 1' of the table.
+ */
+static int build_node(Program *p, unsigned char *table, int level, int offset)
+{
+    int lo, hi, i;
+
+    if (!level)
+        return table_bit(table, offset);
+
+    lo = build_node(p, table, level - 1, offset);
+    hi = build_node(p, table, level - 1, offset + (1 << (level - 1)));
+    if (lo == hi)
+        return lo;
+
+    for (i = 2; i < p->count; i++)
+        if (p->var[i] == level - 1 && p->lo[i] == lo && p->hi[i] == hi)
+            return i;
+
+    assert(p->count < MAX_PROGRAM_SIZE);
+    p->var[p->count] = level - 1;
+    p->lo[p->count] = lo;
+    p->hi[p->count] = hi;
+    return p->count++;
+}
+
+
+static void build_program(Program *p, unsigned char *table)
+{
+    p->count = 2;
+    p->root = build_node(p, table, DONUT_BITS, 0);
+}
+
+
+static void build_programs(void)
+{
+    build_program(&mark_program, mark_table);
+    build_program(&sweep_program, sweep_table);
+    build_program(&final_touch_program, final_touch_table);
+}
+
+
+static Word run_program(Program *p, Word *donut)
+{
+    Word value[MAX_PROGRAM_SIZE];
+    int i;
+
+    value[0] = 0;
+    value[1] = ~(Word) 0;
+    for (i = 2; i < p->count; i++)
+    {
+        Word v = donut[p->var[i]];
+        value[i] = (v & value[p->hi[i]]) | (~v & value[p->lo[i]]);
+    }
+    return value[p->root];
+}
+
+
+/* Rows go from -1 to h and words from -1 to `words'; the margins are zero. */
+typedef struct
+{
+    int w, h;
+    int words;
+    int stride;         /* words + 2 */
+    Word *block;
+} PackedBitmap;
+
+
+static Word *packed_row(PackedBitmap *b, int y)
+{
+    return b->block + (y + 1) * b->stride + 1;
+}
+
+
+static void pack(PackedBitmap *b, unsigned char **pixels, int w, int h)
+{
+    int x, y;
+
+    b->w = w;
+    b->h = h;
+    b->words = (w + WORD_BITS - 1) / WORD_BITS;
+    b->stride = b->words + 2;
+    b->block = MALLOC(Word, (h + 2) * b->stride);
+    memset(b->block, 0, (h + 2) * b->stride * sizeof(Word));
+
+    for (y = 0; y < h; y++)
+    {
+        Word *row = packed_row(b, y);
+        unsigned char *src = pixels[y];
+        for (x = 0; x < w; x++)
+            if (src[x])
+                row[x / WORD_BITS] |= (Word) 1 << (x % WORD_BITS);
+    }
+}
+
+
+/* Fill the 8 donut planes of word `j' in row `y'. */
+static void get_donut(PackedBitmap *b, int y, int j, Word *donut)
+{
+    Word *upper = packed_row(b, y - 1) + j;
+    Word *row   = packed_row(b, y) + j;
+    Word *lower = packed_row(b, y + 1) + j;
+
+#define LEFT(P)  ((P[0] << 1) | (P[-1] >> (WORD_BITS - 1)))
+#define RIGHT(P) ((P[0] >> 1) | (P[1] << (WORD_BITS - 1)))
+    donut[DONUT_A] = LEFT(upper);
+    donut[DONUT_B] = upper[0];
+    donut[DONUT_C] = RIGHT(upper);
+    donut[DONUT_D] = LEFT(row);
+    donut[DONUT_E] = RIGHT(row);
+    donut[DONUT_F] = LEFT(lower);
+    donut[DONUT_G] = lower[0];
+    donut[DONUT_H] = RIGHT(lower);
+#undef LEFT
+#undef RIGHT
+}
+
+
+/* Clean the `candidates' of word `j' in row `y' on which the program says 0,
+ * left to right, as the byte-wide loops do.
+ * Returns 1 if anything was cleaned.
+ */
+static int clean_word(PackedBitmap *b, Program *p, int y, int j, Word candidates)
+{
+    Word *row = packed_row(b, y) + j;
+    Word donut[DONUT_BITS];
+    Word if_white, if_black, dependent, result;
+
+    get_donut(b, y, j, donut);
+    donut[DONUT_D] = 0;
+    if_white = run_program(p, donut);
+    donut[DONUT_D] = ~(Word) 0;
+    if_black = run_program(p, donut);
+
+    result = *row & ~(candidates & ~if_white & ~if_black);
+    dependent = candidates & (if_white ^ if_black);
+    while (dependent)
+    {
+        Word bit = dependent & -dependent;
+        Word left = bit == 1 ? row[-1] >> (WORD_BITS - 1) : result & (bit >> 1);
+        if (!((left ? if_black : if_white) & bit))
+            result &= ~bit;
+        dependent &= dependent - 1;
+    }
+
+    if (result == *row)
+        return 0;
+    *row = result;
+    return 1;
+}
+
+
+/* One mark-and-sweep pass; `candidates' is a scratch bitmap of the same size.
+ * Returns 1 if the image has changed.
+ */
+static int peel_packed(PackedBitmap *b, PackedBitmap *candidates)
+{
+    int y, j;
+    int result = 0;
+    Word any = 0;
+
+    for (y = 0; y < b->h; y++)
+    {
+        Word *row = packed_row(b, y);
+        Word *c = packed_row(candidates, y);
+        for (j = 0; j < b->words; j++)
+        {
+            Word donut[DONUT_BITS];
+            if (!row[j])
+            {
+                c[j] = 0;
+                continue;
+            }
+            get_donut(b, y, j, donut);
+            c[j] = row[j] & ~run_program(&mark_program, donut);
+            any |= c[j];
+        }
+    }
+
+    if (!any)
+        return 0;
+
+    for (y = 0; y < b->h; y++)
+    {
+        Word *c = packed_row(candidates, y);
+        for (j = 0; j < b->words; j++)
+            if (c[j])
+                result |= clean_word(b, &sweep_program, y, j, c[j]);
+    }
+    return result;
+}
+
+
+static unsigned char **skeletonize_packed(unsigned char **pixels, int w, int h,
+                                          int use_8_connectivity)
+{
+    PackedBitmap b, candidates;
+    unsigned char **result;
+    int x, y, j;
+
+    pthread_once(&programs_once, build_programs);
+
+    pack(&b, pixels, w, h);
+    candidates = b;
+    candidates.block = MALLOC(Word, (h + 2) * b.stride);
+
+    while (peel_packed(&b, &candidates)) {}
+
+    if (use_8_connectivity)
+        for (y = 0; y < h; y++)
+            for (j = 0; j < b.words; j++)
+                if (packed_row(&b, y)[j])
+                    clean_word(&b, &final_touch_program, y, j, packed_row(&b, y)[j]);
+
+    result = allocate_bitmap_with_white_margins(w, h);
+    for (y = 0; y < h; y++)
+    {
+        Word *row = packed_row(&b, y);
+        for (x = 0; x < w; x++)
+            result[y][x] = (unsigned char) ((row[x / WORD_BITS] >> (x % WORD_BITS)) & 1);
+    }
+
+    FREE(b.block);
+    FREE(candidates.block);
+    return result;
+}
+
+
+/* ______________________________   worklist thinning   __________________________________ */
+
+
+/* Only pixels near the deleted ones can change, so each pass looks only at
+ * the neighbors of pixels deleted in the previous pass (and, on the first pass,
+ * at all the black pixels). Their mark values are recomputed, and the mark
+ * values of the other pixels remain valid since their donuts haven't changed.
+ *
+ * The sweep must go in the raster order, since a deleted pixel affects
+ * the pixels after it. A pixel deleted during the pass queues its neighbors
+ * that come later in the raster order into the same pass.
+ * A queue is a bitmap of flags plus the range of flagged columns in each row,
+ * so it's walked in the raster order for free.
+ */
+
+
+typedef struct
+{
+    unsigned char **flags;      /* w * h, with margins that are never flagged */
+    int *lo, *hi;               /* flagged columns in each row; lo > hi if none */
+} Queue;
+
+
+typedef struct
+{
+    int w, h;
+    unsigned char **pixels;     /* with margins */
+    unsigned char **marks;      /* w * h, valid for black pixels */
+    Queue now, next;
+} Worklist;
+
+
+static void init_queue(Queue *q, int w, int h)
+{
+    int y;
+    q->flags = allocate_bitmap_with_white_margins(w, h);
+    clear_bitmap(q->flags, w, h);
+    q->lo = MALLOC(int, h + 2) + 1;
+    q->hi = MALLOC(int, h + 2) + 1;
+    for (y = -1; y <= h; y++)
+    {
+        q->lo[y] = w;
+        q->hi[y] = -1;
+    }
+}
+
+
+static void destroy_queue(Queue *q)
+{
+    free_bitmap_with_margins(q->flags);
+    FREE(q->lo - 1);
+    FREE(q->hi - 1);
+}
+
+
+/* The margins of the pixels are white, so there's no need to check bounds. */
+static void enqueue(Worklist *wl, Queue *q, int x, int y)
+{
+    if (!wl->pixels[y][x])
+        return;
+    q->flags[y][x] = 1;
+    if (x < q->lo[y]) q->lo[y] = x;
+    if (x > q->hi[y]) q->hi[y] = x;
+}
+
+
+/* Returns 1 if the image has changed. */
+static int peel_worklist(Worklist *wl)
+{
+    Queue *now = &wl->now;
+    Queue swap;
+    int x, y;
+    int result = 0;
+
+    for (y = 0; y < wl->h; y++)
+    {
+        unsigned char *flags = now->flags[y];
+        unsigned char *row = wl->pixels[y];
+        for (x = now->lo[y]; x <= now->hi[y]; x++)
+            if (flags[x] && row[x])
+                wl->marks[y][x] = get_table_value(mark_table, wl->pixels + y, x) ? 1 : 0;
+    }
+
+    for (y = 0; y < wl->h; y++)
+    {
+        unsigned char *flags = now->flags[y];
+        unsigned char *row = wl->pixels[y];
+        unsigned char *marks = wl->marks[y];
+
+        /* the range may grow as we go */
+        for (x = now->lo[y]; x <= now->hi[y]; x++)
+        {
+            int dx, dy;
+
+            if (!flags[x])
+                continue;
+            flags[x] = 0;
+            if (!row[x] || marks[x] || get_table_value(sweep_table, wl->pixels + y, x))
+                continue;
+
+            row[x] = 0;
+            result = 1;
+
+            enqueue(wl, now, x + 1, y);
+            enqueue(wl, now, x - 1, y + 1);
+            enqueue(wl, now, x,     y + 1);
+            enqueue(wl, now, x + 1, y + 1);
+            for (dy = -1; dy <= 1; dy++)
+                for (dx = -1; dx <= 1; dx++)
+                    enqueue(wl, &wl->next, x + dx, y + dy);
+        }
+        now->lo[y] = wl->w;
+        now->hi[y] = -1;
+    }
+
+    swap = wl->now;
+    wl->now = wl->next;
+    wl->next = swap;
+    return result;
+}
+
+
+static unsigned char **skeletonize_worklist(unsigned char **pixels, int w, int h,
+                                            int use_8_connectivity)
+{
+    Worklist wl;
+    int x, y;
+
+    wl.w = w;
+    wl.h = h;
+    wl.pixels = provide_margins(pixels, w, h, /* make_it_0_or_1: */ 1);
+    wl.marks = allocate_bitmap(w, h);
+    init_queue(&wl.now, w, h);
+    init_queue(&wl.next, w, h);
+
+    for (y = 0; y < h; y++)
+        for (x = 0; x < w; x++)
+            enqueue(&wl, &wl.now, x, y);
+
+    while (peel_worklist(&wl)) {}
+
+    if (use_8_connectivity)
+        force_8_connectivity(wl.pixels, w, h);
+
+    free_bitmap(wl.marks);
+    destroy_queue(&wl.now);
+    destroy_queue(&wl.next);
+    return wl.pixels;
+}
+
+
+/* ______________________________   skeletonization   __________________________________ */
+
+
+static unsigned char **skeletonize_bytes(unsigned char **pixels, int w, int h,
+                                         int use_8_connectivity, int make_it_0_or_1)
 {
     unsigned char **buffer = provide_margins(pixels, w, h, make_it_0_or_1);
 
@@ -215,7 +852,7 @@ unsigned char **skeletonize_internal(unsigned char **pixels, int w, int h,
      * we use buffer as the main pixel array,
      * and the original pixels array is used to mark candidates for sweeping.
      */
-    while (peel(buffer, pixels, w, h)) {}
+    while (peel_bytes(buffer, pixels, w, h)) {}
 
     if (use_8_connectivity)
         force_8_connectivity(buffer, w, h);
@@ -224,16 +861,151 @@ unsigned char **skeletonize_internal(unsigned char **pixels, int w, int h,
 }
 
 
+unsigned char **skeletonize_with_method(unsigned char **pixels, int w, int h,
+                                        int use_8_connectivity, ThinningMethod method)
+{
+    unsigned char **buffer, **result;
+
+    switch (method)
+    {
+        case THINNING_BYTES:
+            buffer = copy_bitmap(pixels, w, h);
+            result = skeletonize_bytes(buffer, w, h, use_8_connectivity, 1);
+            free_bitmap(buffer);
+            return result;
+        case THINNING_PACKED:
+            return skeletonize_packed(pixels, w, h, use_8_connectivity);
+        case THINNING_WORKLIST:
+            return skeletonize_worklist(pixels, w, h, use_8_connectivity);
+        case THINNING_ROLLING:
+            return skeletonize_rolling(pixels, w, h, use_8_connectivity);
+    }
+
+    assert(0);
+    return NULL;
+}
+
+
 unsigned char **skeletonize(unsigned char **pixels, int w, int h, int use_8_connectivity)
 {
-    unsigned char **buffer = copy_bitmap(pixels, w, h);
-    unsigned char **result = skeletonize_internal(buffer, w, h, use_8_connectivity, 1);
-    free_bitmap(buffer);
-    return result;
+    return skeletonize_packed(pixels, w, h, use_8_connectivity);
 }
 
 
-unsigned char **thicken(unsigned char **pixels, int w, int h, int N)
+/* ______________________________   page skeletonization   __________________________________ */
+
+
+/* A pixel's fate depends only on its 8 neighbors, and white pixels stay white.
+ * So a blank row is a halo that nothing crosses: the pieces of the page
+ * between blank rows are thinned by skeletonize() on their own,
+ * and pasting their skeletons together gives exactly the skeleton of the page.
+ * The page is cut into tiles at blank rows, and threads take tiles one by one.
+ * A page without blank rows is a single tile.
+ */
+
+
+typedef struct
+{
+    unsigned char **pixels, **result;
+    int w, use_8_connectivity;
+    int count, next;
+    int *tops;                  /* count + 1 of them, the last one is h */
+    pthread_mutex_t mutex;
+} PageTiles;
+
+
+static int row_is_blank(unsigned char *row, int w)
+{
+    int x;
+    for (x = 0; x < w; x++)
+        if (row[x])
+            return 0;
+    return 1;
+}
+
+
+static void cut_page_into_tiles(PageTiles *t, int h, int min_height)
+{
+    int top = 0, y;
+
+    t->tops = MALLOC(int, h + 1);
+    t->count = 0;
+    t->tops[t->count++] = 0;
+    for (y = 0; y < h; y++)
+    {
+        if (y - top >= min_height && row_is_blank(t->pixels[y], t->w))
+        {
+            t->tops[t->count++] = top = y;
+        }
+    }
+    t->tops[t->count] = h;
+}
+
+
+static void *thin_tiles(void *arg)
+{
+    PageTiles *t = (PageTiles *) arg;
+
+    while (1)
+    {
+        unsigned char **skeleton;
+        int i, top, h;
+
+        pthread_mutex_lock(&t->mutex);
+        i = t->next++;
+        pthread_mutex_unlock(&t->mutex);
+        if (i >= t->count)
+            break;
+
+        top = t->tops[i];
+        h = t->tops[i + 1] - top;
+        skeleton = skeletonize(t->pixels + top, t->w, h, t->use_8_connectivity);
+        assign_bitmap(t->result + top, skeleton, t->w, h);
+        free_bitmap_with_margins(skeleton);
+    }
+
+    return NULL;
+}
+
+
+unsigned char **skeletonize_page(unsigned char **pixels, int w, int h,
+                                 int use_8_connectivity, int threads)
+{
+    PageTiles t;
+    pthread_t *helpers;
+    int started, i;
+
+    if (threads < 1)
+        threads = 1;
+
+    t.pixels = pixels;
+    t.result = allocate_bitmap_with_white_margins(w, h);
+    t.w = w;
+    t.use_8_connectivity = use_8_connectivity;
+    t.next = 0;
+    pthread_mutex_init(&t.mutex, NULL);
+
+    /* several tiles per thread, so that a slow tile doesn't keep the others idle */
+    cut_page_into_tiles(&t, h, h / (threads * 4) + 1);
+
+    /* the calling thread works too; if a helper fails to start, fine */
+    helpers = MALLOC(pthread_t, threads);
+    for (started = 0; started < threads - 1; started++)
+        if (pthread_create(&helpers[started], NULL, thin_tiles, &t))
+            break;
+    thin_tiles(&t);
+    for (i = 0; i < started; i++)
+        pthread_join(helpers[i], NULL);
+
+    FREE(helpers);
+    FREE(t.tops);
+    pthread_mutex_destroy(&t.mutex);
+    return t.result;
+}
+
+
+static unsigned char **thicken_with(PeelFunction peel_function,
+                                    unsigned char **pixels, int w, int h, int N)
 {
     int r_w = w + (N + 1) * 2;
     int r_h = h + (N + 1) * 2;
@@ -256,7 +1028,7 @@ unsigned char **thicken(unsigned char **pixels, int w, int h, int N)
     invert_bitmap(buf, r_w, r_h, 1); /* we get margins of 2 black pixels */
     while (N--)
     {
-        if (!peel(pbuf, aux, w + N * 2, h + N * 2))
+        if (!peel_function(pbuf, aux, w + N * 2, h + N * 2))
             break;
     }
     invert_bitmap(buf, r_w, r_h, 0);
@@ -265,3 +1037,141 @@ unsigned char **thicken(unsigned char **pixels, int w, int h, int N)
     FREE(buf);
     return pbuf;
 }
+
+
+unsigned char **thicken(unsigned char **pixels, int w, int h, int N)
+{
+    return thicken_with(peel, pixels, w, h, N);
+}
+
+
+/* ______________________________   testing   __________________________________ */
+
+#ifdef TESTING
+
+/* Random filled disks, to get thick strokes with many peeling passes. */
+static unsigned char **blobs(int w, int h, int count)
+{
+    unsigned char **pixels = allocate_bitmap(w, h);
+    int i, x, y;
+
+    clear_bitmap(pixels, w, h);
+    for (i = 0; i < count; i++)
+    {
+        int cx = rand() % w, cy = rand() % h, r = 1 + rand() % 12;
+        for (y = 0; y < h; y++)
+            for (x = 0; x < w; x++)
+                if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= r * r)
+                    pixels[y][x] = 1 + rand() % 255;
+    }
+    return pixels;
+}
+
+static void check_methods(unsigned char **pixels, int w, int h)
+{
+    int c8;
+    for (c8 = 0; c8 < 2; c8++)
+    {
+        unsigned char **expected = skeletonize_with_method(pixels, w, h, c8, THINNING_BYTES);
+        unsigned char **packed = skeletonize_with_method(pixels, w, h, c8, THINNING_PACKED);
+        unsigned char **worklist = skeletonize_with_method(pixels, w, h, c8, THINNING_WORKLIST);
+        unsigned char **rolling = skeletonize_with_method(pixels, w, h, c8, THINNING_ROLLING);
+        assert(bitmaps_equal(expected, packed, w, h));
+        assert(bitmaps_equal(expected, worklist, w, h));
+        assert(bitmaps_equal(expected, rolling, w, h));
+        free_bitmap_with_margins(expected);
+        free_bitmap_with_margins(packed);
+        free_bitmap_with_margins(worklist);
+        free_bitmap_with_margins(rolling);
+    }
+}
+
+static void test_methods(void)
+{
+    static const int widths[] = {1, 2, 3, 31, 32, 33, 63, 64, 65, 100, 129, 0};
+    static const int heights[] = {1, 2, 17, 64, 100, 0};
+    int i, j;
+
+    srand(29);
+    for (i = 0; widths[i]; i++)
+        for (j = 0; heights[j]; j++)
+        {
+            int w = widths[i], h = heights[j];
+            unsigned char **noise = simple_noise(w, h);
+            unsigned char **b = blobs(w, h, 1 + w * h / 200);
+            check_methods(noise, w, h);
+            check_methods(b, w, h);
+            free_bitmap(noise);
+            free_bitmap(b);
+        }
+}
+
+/* peel() must not take the margins for white: thicken() peels
+ * an inverted bitmap, whose margins are black.
+ */
+static void test_thin_and_thicken(void)
+{
+    static const int widths[] = {1, 5, 16, 33, 0};
+    int i, n;
+
+    srand(37);
+    for (i = 0; widths[i]; i++)
+    {
+        int w = widths[i], h = 20;
+        unsigned char **noise = simple_noise(w, h);
+        unsigned char **b = blobs(w, h, 3);
+
+        for (n = 1; n <= 3; n++)
+        {
+            unsigned char **expected = thin_with(peel_bytes, b, w, h, n);
+            unsigned char **result = thin(b, w, h, n);
+            assert(bitmaps_equal(expected, result, w, h));
+            free_bitmap_with_margins(expected);
+            free_bitmap_with_margins(result);
+
+            expected = thicken_with(peel_bytes, noise, w, h, n);
+            result = thicken(noise, w, h, n);
+            assert(bitmaps_equal(expected, result, w + 2 * n, h + 2 * n));
+            free_bitmap_with_margins(expected);
+            free_bitmap_with_margins(result);
+        }
+        free_bitmap(noise);
+        free_bitmap(b);
+    }
+}
+
+/* Blobs with blank rows here and there, so that the page falls into tiles. */
+static void test_page(void)
+{
+    int w = 150, h = 400, threads, c8, y;
+    unsigned char **pixels;
+
+    srand(31);
+    pixels = blobs(w, h, 150);
+    for (y = 0; y < h; y += 1 + rand() % 40)
+        memset(pixels[y], 0, w);
+
+    for (c8 = 0; c8 < 2; c8++)
+    {
+        unsigned char **expected = skeletonize(pixels, w, h, c8);
+        for (threads = 1; threads <= 4; threads++)
+        {
+            unsigned char **page = skeletonize_page(pixels, w, h, c8, threads);
+            assert(bitmaps_equal(expected, page, w, h));
+            free_bitmap_with_margins(page);
+        }
+        free_bitmap_with_margins(expected);
+    }
+    free_bitmap(pixels);
+}
+
+static TestFunction tests[] = {
+    test_methods,
+    test_thin_and_thicken,
+    test_page,
+    NULL
+};
+
+TestSuite thinning_suite = {"thinning", NULL, NULL, tests};
+
+#endif
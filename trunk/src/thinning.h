@@ -57,11 +57,27 @@ unsigned char **skeletonize(unsigned char **pixels, int width, int height,
                             int use_8_connectivity /* nonzero - true */);
 
 
-/* Same as skeletonize(), but the original bitmap is overwritten with garbage
- * and it also accepts `make_it_0_or_1' (0 - all pixels are already 0/1).
+/* The same as skeletonize(), but for the whole page and in `threads' threads.
+ * The page is cut into tiles at blank rows, so it's no good for a page
+ * without any (e.g. a page in a black frame) - that's done in one thread.
  */
-unsigned char **skeletonize_internal(unsigned char **pixels, int width, int height,
-                                     int use_8_connectivity, int make_it_0_or_1);
+unsigned char **skeletonize_page(unsigned char **pixels, int width, int height,
+                                 int use_8_connectivity, int threads);
+
+
+/* The ways to compute the same skeleton, for testing and benchmarks.
+ * skeletonize() picks the fastest one.
+ */
+typedef enum
+{
+    THINNING_BYTES,     /* a byte per pixel, table lookups pixel by pixel */
+    THINNING_PACKED,    /* a bit per pixel, a word of pixels at once */
+    THINNING_WORKLIST,  /* a byte per pixel, only near the deleted pixels */
+    THINNING_ROLLING    /* a byte per pixel, the donut rolls along the row */
+} ThinningMethod;
+
+unsigned char **skeletonize_with_method(unsigned char **pixels, int width, int height,
+                                        int use_8_connectivity, ThinningMethod);
 
 
 /* Low-level thinning routine.
@@ -86,6 +102,11 @@ unsigned char **thin(unsigned char **pixels, int w, int h, int N);
  */
 unsigned char **thicken(unsigned char **pixels, int w, int h, int N);
 
+
+#ifdef TESTING
+extern TestSuite thinning_suite;
+#endif
+
 FUNCTIONS_END
 
 #endif
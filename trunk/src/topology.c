@@ -0,0 +1,291 @@
+/* Plasma OCR - an OCR engine
+ *
+ * topology.c - an index of patterns by the topology of their skeletons
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "common.h"
+#include "topology.h"
+#include <assert.h>
+#include <string.h>
+
+
+typedef struct
+{
+    unsigned long hash;
+    Pattern representative;
+    int count, allocated;
+    int *indices;
+    int next;               /* next bucket in the chain, or -1 */
+} Bucket;
+
+
+struct TopologyIndexStruct
+{
+    int buckets_count, buckets_allocated;
+    Bucket *buckets;
+    int table_size;         /* a power of 2 */
+    int *table;             /* heads of the chains, -1 for empty */
+};
+
+
+static Bucket *append_bucket(TopologyIndex t)
+    LIST_APPEND(Bucket, t->buckets, t->buckets_count, t->buckets_allocated)
+
+static int *append_index(Bucket *b)
+    LIST_APPEND(int, b->indices, b->count, b->allocated)
+
+
+static int find_bucket(TopologyIndex t, unsigned long hash, Pattern p)
+{
+    int i = t->table[hash & (t->table_size - 1)];
+
+    while (i != -1)
+    {
+        Bucket *b = &t->buckets[i];
+        if (b->hash == hash && patterns_topology_equal(b->representative, p))
+            return i;
+        i = b->next;
+    }
+
+    return -1;
+}
+
+
+TopologyIndex create_topology_index(int count, Pattern *patterns)
+{
+    TopologyIndex t = MALLOC1(struct TopologyIndexStruct);
+    int i;
+
+    /* There are much fewer topologies than patterns,
+     * so the table never has to grow.
+     */
+    t->table_size = 64;
+    while (t->table_size < count)
+        t->table_size <<= 1;
+    t->table = MALLOC(int, t->table_size);
+    for (i = 0; i < t->table_size; i++)
+        t->table[i] = -1;
+
+    LIST_CREATE(Bucket, t->buckets, t->buckets_count, t->buckets_allocated, 16);
+
+    for (i = 0; i < count; i++)
+    {
+        unsigned long hash = pattern_topology_hash(patterns[i]);
+        int k = find_bucket(t, hash, patterns[i]);
+        if (k == -1)
+        {
+            int *head = &t->table[hash & (t->table_size - 1)];
+            Bucket *b = append_bucket(t);
+            b->hash = hash;
+            b->representative = patterns[i];
+            LIST_CREATE(int, b->indices, b->count, b->allocated, 4);
+            b->next = *head;
+            k = *head = t->buckets_count - 1;
+        }
+        *append_index(&t->buckets[k]) = i;
+    }
+
+    return t;
+}
+
+
+void free_topology_index(TopologyIndex t)
+{
+    int i;
+    for (i = 0; i < t->buckets_count; i++)
+        FREE(t->buckets[i].indices);
+    FREE(t->buckets);
+    FREE(t->table);
+    FREE1(t);
+}
+
+
+int topology_index_lookup(TopologyIndex t, Pattern p, const int **indices)
+{
+    int k = find_bucket(t, pattern_topology_hash(p), p);
+
+    if (k == -1)
+    {
+        *indices = NULL;
+        return 0;
+    }
+
+    *indices = t->buckets[k].indices;
+    return t->buckets[k].count;
+}
+
+
+/* ______________________________   testing   __________________________________ */
+
+#ifdef TESTING
+
+#include "chaincode.h"
+#include "io.h"
+
+#define MAX_TEST_ROPES 10
+
+typedef struct
+{
+    int nodes, ropes;
+    int ends[2 * MAX_TEST_ROPES];    /* start and end node of each rope */
+} TestTopology;
+
+
+/* Degrees go up to 10, past MAX_SORTED_DEGREE of pattern.c (8).
+ * The last three have the same numbers of nodes of each degree below 8
+ * and two nodes above, so only their big degrees tell them apart.
+ */
+static TestTopology test_topologies[] = {
+    {2, 1, {0,1}},
+    {1, 1, {0,0}},
+    {2, 1, {1,0}},
+    {3, 2, {0,1, 1,2}},
+    {3, 2, {0,1, 0,1}},
+    {3, 2, {2,1, 1,0}},
+    {2, 5, {0,1, 0,0, 0,0, 0,0, 0,0}},
+    {2, 5, {0,1, 0,1, 0,1, 0,1, 0,1}},
+    {2, 5, {1,0, 1,1, 1,1, 1,1, 1,1}},
+    {2, 9, {0,0, 0,0, 0,0, 0,0, 1,1, 1,1, 1,1, 1,1, 0,1}},
+    {2, 9, {0,0, 0,0, 0,0, 0,0, 1,1, 1,1, 1,1, 1,1, 1,1}},
+    {2, 9, {1,1, 1,1, 1,1, 1,1, 0,0, 0,0, 0,0, 0,0, 0,0}},
+};
+
+#define TEST_TOPOLOGIES ((int) (sizeof(test_topologies) / sizeof(TestTopology)))
+
+
+/* Sorted node degrees of the topology. */
+static void get_test_degrees(TestTopology *t, int *degrees)
+{
+    int i, j;
+
+    memset(degrees, 0, t->nodes * sizeof(int));
+    for (i = 0; i < 2 * t->ropes; i++)
+        degrees[t->ends[i]]++;
+
+    for (i = 1; i < t->nodes; i++)
+        for (j = i; j > 0 && degrees[j - 1] > degrees[j]; j--)
+        {
+            int d = degrees[j];
+            degrees[j] = degrees[j - 1];
+            degrees[j - 1] = d;
+        }
+}
+
+
+static int test_topologies_equal(TestTopology *t1, TestTopology *t2)
+{
+    int d1[2 * MAX_TEST_ROPES], d2[2 * MAX_TEST_ROPES];
+
+    if (t1->nodes != t2->nodes || t1->ropes != t2->ropes)
+        return 0;
+    get_test_degrees(t1, d1);
+    get_test_degrees(t2, d2);
+    return !memcmp(d1, d2, t1->nodes * sizeof(int));
+}
+
+
+/* Make a pattern of the given topology by loading its chaincode.
+ * Each rope is a single step; coordinates and the fingerprint are zero.
+ */
+static Pattern make_test_pattern(FilePair fp, TestTopology *t)
+{
+    Chaincode *cc = chaincode_create(1, 1);
+    FILE *f;
+    float zero = 0;
+    int i;
+
+    for (i = 0; i < t->nodes; i++)
+    {
+        Node *node = chaincode_append_node(cc);
+        node->x = node->y = 0;
+        node->degree = 0;
+        node->rope_indices = NULL;
+    }
+    for (i = 0; i < t->ropes; i++)
+    {
+        Rope *rope = chaincode_append_rope(cc);
+        rope->start = t->ends[2 * i];
+        rope->end = t->ends[2 * i + 1];
+        rope->length = 1;
+        rope->steps = "6";
+        cc->nodes[rope->start].degree++;
+        cc->nodes[rope->end].degree++;
+    }
+
+    f = file_pair_write(fp);
+    chaincode_save(cc, f);
+    for (i = 0; i < 2 * t->ropes; i++)
+        fwrite(&zero, 1, sizeof(zero), f);
+    for (i = 0; i < (int) sizeof(Fingerprint); i++)
+        fputc(0, f);
+
+    FREE(cc->nodes);
+    FREE(cc->ropes);
+    FREE1(cc);
+    return load_pattern(file_pair_read(fp));
+}
+
+
+static void test_lookup(void)
+{
+    FilePair fp = file_pair_open();
+    Pattern patterns[TEST_TOPOLOGIES];
+    TopologyIndex index;
+    TestTopology lonely = {4, 2, {0,1, 2,3}};
+    Pattern p;
+    const int *found;
+    int i, j, k, n;
+
+    for (i = 0; i < TEST_TOPOLOGIES; i++)
+        patterns[i] = make_test_pattern(fp, &test_topologies[i]);
+    index = create_topology_index(TEST_TOPOLOGIES, patterns);
+
+    for (i = 0; i < TEST_TOPOLOGIES; i++)
+    {
+        n = topology_index_lookup(index, patterns[i], &found);
+        k = 0;
+        for (j = 0; j < TEST_TOPOLOGIES; j++)
+        {
+            if (!test_topologies_equal(&test_topologies[i], &test_topologies[j]))
+                continue;
+            assert(k < n && found[k] == j);
+            k++;
+        }
+        assert(k == n);
+    }
+
+    p = make_test_pattern(fp, &lonely);
+    assert(!topology_index_lookup(index, p, &found) && !found);
+    free_pattern(p);
+
+    free_topology_index(index);
+    for (i = 0; i < TEST_TOPOLOGIES; i++)
+        free_pattern(patterns[i]);
+    file_pair_close(fp);
+}
+
+static TestFunction tests[] = {
+    test_lookup,
+    NULL
+};
+
+TestSuite topology_suite = {"topology", NULL, NULL, tests};
+
+#endif
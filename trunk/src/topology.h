@@ -0,0 +1,57 @@
+/* Plasma OCR - an OCR engine
+ *
+ * topology.h - an index of patterns by the topology of their skeletons
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/* Most library patterns can't match a given one just because their
+ * skeletons have different numbers of nodes or ropes, or different degrees.
+ * The index groups patterns into buckets by pattern_topology_hash()
+ * so that only the bucket of the same topology has to be scanned.
+ */
+
+
+#ifndef PLASMA_OCR_TOPOLOGY_H
+#define PLASMA_OCR_TOPOLOGY_H
+
+
+#include "pattern.h"
+
+
+typedef struct TopologyIndexStruct *TopologyIndex;
+
+
+/* Index the patterns; their indices in the array are what lookups return.
+ * The patterns should stay alive while the index is used.
+ */
+TopologyIndex create_topology_index(int count, Pattern *patterns);
+void free_topology_index(TopologyIndex);
+
+/* Find the patterns with the same topology as `p'.
+ * Returns their count and sets `*indices' to an ascending array
+ * owned by the index (NULL if there are none).
+ */
+int topology_index_lookup(TopologyIndex, Pattern p, const int **indices);
+
+
+#ifdef TESTING
+extern TestSuite topology_suite;
+#endif
+
+#endif
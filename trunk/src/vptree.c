@@ -0,0 +1,372 @@
+/* Plasma OCR - an OCR engine
+ *
+ * vptree.c - vantage-point tree over shift-n-cut fingerprints
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include "common.h"
+#include "vptree.h"
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+
+
+/* Subtrees of this size or less are scanned linearly. */
+#define LEAF_SIZE 32
+
+/* Distances are square roots of integers, so rounding errors are tiny;
+ * this is a safety margin for the pruning test.
+ */
+#define EPSILON 1e-6
+
+
+typedef struct
+{
+    int vantage;            /* position of the vantage point, -1 for a leaf */
+    double inner_radius;    /* the inner subtree lies within this distance */
+    double outer_min;       /* and the outer one lies within these two */
+    double outer_max;
+    int inner, outer;       /* children (node indices), -1 if empty */
+    int begin, end;         /* a leaf covers positions begin..end-1 */
+} TreeNode;
+
+
+struct FingerprintTreeStruct
+{
+    int count;
+    int *order;                 /* original indices, in the tree order */
+    Fingerprint *fingerprints;  /* in the tree order */
+    int nodes_count, nodes_allocated;
+    TreeNode *nodes;
+    int root;
+};
+
+
+typedef struct
+{
+    double distance;
+    int index;
+} Neighbor;
+
+
+static TreeNode *append_node(FingerprintTree t)
+    LIST_APPEND(TreeNode, t->nodes, t->nodes_count, t->nodes_allocated)
+
+
+static double distance(Fingerprint f1, Fingerprint f2)
+{
+    return sqrt((double) fingerprint_distance_squared(f1, f2));
+}
+
+
+static int compare_neighbors(const void *p1, const void *p2)
+{
+    const Neighbor *n1 = (const Neighbor *) p1;
+    const Neighbor *n2 = (const Neighbor *) p2;
+    if (n1->distance < n2->distance) return -1;
+    if (n1->distance > n2->distance) return 1;
+    return n1->index - n2->index;
+}
+
+
+/* Build a subtree over positions begin..end-1 of t->order.
+ * `fingerprints' are the original ones (indexed by the original index).
+ * Returns the node index or -1 for an empty range.
+ */
+static int build(FingerprintTree t, Fingerprint *fingerprints,
+                 int begin, int end, Neighbor *buffer, unsigned long *seed)
+{
+    int n = end - begin;
+    int node;
+    int i, half, swap;
+    Fingerprint *vp;
+    TreeNode *tn;
+
+    if (n <= 0)
+        return -1;
+
+    if (n <= LEAF_SIZE)
+    {
+        tn = append_node(t);
+        tn->vantage = -1;
+        tn->begin = begin;
+        tn->end = end;
+        tn->inner = tn->outer = -1;
+        return t->nodes_count - 1;
+    }
+
+    /* pick a pseudorandom vantage point and move it to the front */
+    *seed = *seed * 1103515245UL + 12345UL;
+    i = begin + (int) ((*seed >> 16) % n);
+    swap = t->order[i];
+    t->order[i] = t->order[begin];
+    t->order[begin] = swap;
+    vp = &fingerprints[t->order[begin]];
+
+    for (i = begin + 1; i < end; i++)
+    {
+        buffer[i].index = t->order[i];
+        buffer[i].distance = distance(*vp, fingerprints[t->order[i]]);
+    }
+    qsort(buffer + begin + 1, n - 1, sizeof(Neighbor), compare_neighbors);
+    for (i = begin + 1; i < end; i++)
+        t->order[i] = buffer[i].index;
+
+    half = (n - 1) / 2;
+
+    /* children may move the nodes list, so we fill the node afterwards */
+    node = t->nodes_count;
+    append_node(t);
+    t->nodes[node].vantage = begin;
+    t->nodes[node].inner_radius = buffer[begin + half].distance;
+    t->nodes[node].outer_min = buffer[begin + half + 1].distance;
+    t->nodes[node].outer_max = buffer[end - 1].distance;
+
+    i = build(t, fingerprints, begin + 1, begin + 1 + half, buffer, seed);
+    t->nodes[node].inner = i;
+    i = build(t, fingerprints, begin + 1 + half, end, buffer, seed);
+    t->nodes[node].outer = i;
+    return node;
+}
+
+
+FingerprintTree create_fingerprint_tree(int count, Fingerprint *fingerprints)
+{
+    FingerprintTree t = MALLOC1(struct FingerprintTreeStruct);
+    Neighbor *buffer = MALLOC(Neighbor, count + 1);
+    unsigned long seed = 57;
+    int i;
+
+    t->count = count;
+    t->order = MALLOC(int, count + 1);
+    t->fingerprints = MALLOC(Fingerprint, count + 1);
+    for (i = 0; i < count; i++)
+        t->order[i] = i;
+
+    LIST_CREATE(TreeNode, t->nodes, t->nodes_count, t->nodes_allocated, 16);
+    t->root = build(t, fingerprints, 0, count, buffer, &seed);
+
+    for (i = 0; i < count; i++)
+        memcpy(t->fingerprints[i], fingerprints[t->order[i]], sizeof(Fingerprint));
+
+    FREE(buffer);
+    return t;
+}
+
+
+void free_fingerprint_tree(FingerprintTree t)
+{
+    FREE(t->order);
+    FREE(t->fingerprints);
+    FREE(t->nodes);
+    FREE1(t);
+}
+
+
+/* ______________________________   search   __________________________________ */
+
+
+typedef struct
+{
+    FingerprintTree tree;
+    unsigned char *query;
+    int (*accept)(int, void *);
+    void *data;
+    long best_distance;     /* squared */
+    double best_radius;     /* its square root plus EPSILON */
+    int best;               /* original index */
+} Search;
+
+
+static void consider(Search *s, int position, long d)
+{
+    int index = s->tree->order[position];
+
+    if (d > s->best_distance || (d == s->best_distance && index > s->best))
+        return;
+    if (s->accept && !s->accept(index, s->data))
+        return;
+
+    s->best = index;
+    s->best_distance = d;
+    s->best_radius = sqrt((double) d) + EPSILON;
+}
+
+
+static void search(Search *s, int node)
+{
+    TreeNode *tn = &s->tree->nodes[node];
+    Fingerprint *fingerprints = s->tree->fingerprints;
+    long d2;
+    double d;
+
+    if (tn->vantage == -1)
+    {
+        long distances[LEAF_SIZE];
+        int i;
+        fingerprint_distances_squared(s->query, fingerprints + tn->begin,
+                                      tn->end - tn->begin, distances);
+        for (i = tn->begin; i < tn->end; i++)
+            consider(s, i, distances[i - tn->begin]);
+        return;
+    }
+
+    d2 = fingerprint_distance_squared(s->query, fingerprints[tn->vantage]);
+    consider(s, tn->vantage, d2);
+    d = sqrt((double) d2);
+
+    /* Visit the more promising child first.
+     * The other one is visited only if its lower bound isn't too large.
+     */
+    if (d <= tn->inner_radius)
+    {
+        if (tn->inner != -1)
+            search(s, tn->inner);
+        if (tn->outer != -1 && tn->outer_min - d <= s->best_radius)
+            search(s, tn->outer);
+    }
+    else
+    {
+        if (tn->outer != -1 && tn->outer_min - d <= s->best_radius
+                            && d - tn->outer_max <= s->best_radius)
+        {
+            search(s, tn->outer);
+        }
+        if (tn->inner != -1 && d - tn->inner_radius <= s->best_radius)
+            search(s, tn->inner);
+    }
+}
+
+
+int fingerprint_tree_improve(FingerprintTree t, Fingerprint query,
+                             int (*accept)(int index, void *data), void *data,
+                             int best, long *distance)
+{
+    Search s;
+    s.tree = t;
+    s.query = query;
+    s.accept = accept;
+    s.data = data;
+    s.best = best;
+    if (best == -1)
+    {
+        s.best_distance = 0x7FFFFFFFL;
+        s.best_radius = 1e10;
+    }
+    else
+    {
+        s.best_distance = *distance;
+        s.best_radius = sqrt((double) *distance) + EPSILON;
+    }
+
+    if (t->root != -1)
+        search(&s, t->root);
+
+    *distance = s.best_distance;
+    return s.best;
+}
+
+
+int fingerprint_tree_nearest(FingerprintTree t, Fingerprint query,
+                             int (*accept)(int index, void *data), void *data,
+                             long *distance)
+{
+    long d;
+    int best = fingerprint_tree_improve(t, query, accept, data, -1, &d);
+    if (distance)
+        *distance = d;
+    return best;
+}
+
+
+/* ______________________________   testing   __________________________________ */
+
+#ifdef TESTING
+
+static int accept_odd(int index, void *data)
+{
+    return index & 1;
+}
+
+static int linear_nearest(int n, Fingerprint *f, Fingerprint query,
+                          int (*accept)(int, void *))
+{
+    int i;
+    int best = -1;
+    long best_distance = 0x7FFFFFFFL;
+    for (i = 0; i < n; i++)
+    {
+        long d = fingerprint_distance_squared(query, f[i]);
+        if (d < best_distance && (!accept || accept(i, NULL)))
+        {
+            best = i;
+            best_distance = d;
+        }
+    }
+    return best;
+}
+
+/* Compare against the linear scan on random fingerprints.
+ * Values are taken from a small range to get many ties.
+ */
+static void test_nearest(void)
+{
+    int n = 1000;
+    Fingerprint *f = MALLOC(Fingerprint, n);
+    FingerprintTree t;
+    int i, j;
+
+    srand(57);
+    for (i = 0; i < n; i++)
+        for (j = 0; j < (int) sizeof(Fingerprint); j++)
+            f[i][j] = 120 + rand() % 8;
+
+    t = create_fingerprint_tree(n, f);
+    for (i = 0; i < 200; i++)
+    {
+        Fingerprint q;
+        for (j = 0; j < (int) sizeof(Fingerprint); j++)
+            q[j] = 120 + rand() % 8;
+        assert(fingerprint_tree_nearest(t, q, NULL, NULL, NULL)
+               == linear_nearest(n, f, q, NULL));
+        assert(fingerprint_tree_nearest(t, q, accept_odd, NULL, NULL)
+               == linear_nearest(n, f, q, accept_odd));
+        assert(fingerprint_tree_nearest(t, f[i], NULL, NULL, NULL)
+               == linear_nearest(n, f, f[i], NULL));
+
+        /* starting from some odd point shouldn't change anything */
+        {
+            int start = 2 * i + 1;
+            long d = fingerprint_distance_squared(q, f[start]);
+            assert(fingerprint_tree_improve(t, q, accept_odd, NULL, start, &d)
+                   == linear_nearest(n, f, q, accept_odd));
+        }
+    }
+    free_fingerprint_tree(t);
+    FREE(f);
+}
+
+static TestFunction tests[] = {
+    test_nearest,
+    NULL
+};
+
+TestSuite vptree_suite = {"vptree", NULL, NULL, tests};
+
+#endif
@@ -0,0 +1,70 @@
+/* Plasma OCR - an OCR engine
+ *
+ * vptree.h - vantage-point tree over shift-n-cut fingerprints
+ *
+ * Copyright (C) 2006  Ilya Mezhirov
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+/* Each node of the tree picks a vantage point and splits the rest
+ * by the median distance to it. A search skips a subtree
+ * when the triangle inequality says it can't hold anything closer
+ * than the best point found so far, so the answer is exact.
+ */
+
+
+#ifndef PLASMA_OCR_VPTREE_H
+#define PLASMA_OCR_VPTREE_H
+
+
+#include "shiftcut.h"
+
+
+typedef struct FingerprintTreeStruct *FingerprintTree;
+
+
+/* Build a tree over `count' fingerprints (they are copied). */
+FingerprintTree create_fingerprint_tree(int count, Fingerprint *fingerprints);
+void free_fingerprint_tree(FingerprintTree);
+
+
+/* Find the fingerprint nearest to `query' among those accepted by `accept'
+ * (which may be NULL to accept everything).
+ * Of several equally near ones, the one with the lowest index wins,
+ * just like in a linear scan.
+ *
+ * Returns the index or -1 if nothing was accepted.
+ * The squared distance is stored into `*distance' unless it's NULL.
+ */
+int fingerprint_tree_nearest(FingerprintTree, Fingerprint query,
+                             int (*accept)(int index, void *data), void *data,
+                             long *distance);
+
+/* The same, but start from a known accepted point `best' (at the squared
+ * distance `*distance') and only look for better ones. A good start
+ * prunes more of the tree. Returns `best' if there's nothing better.
+ */
+int fingerprint_tree_improve(FingerprintTree, Fingerprint query,
+                             int (*accept)(int index, void *data), void *data,
+                             int best, long *distance);
+
+
+#ifdef TESTING
+extern TestSuite vptree_suite;
+#endif
+
+#endif
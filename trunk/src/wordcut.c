@@ -103,15 +103,12 @@ static void fill_shields(int w, unsigned char *shields, int level, unsigned char
 }
 
 
-static int *make_histogram(unsigned char **pixels, int w, int h)
+static int *make_histogram(Projection p, int w, int h)
 {
     int *histogram = MALLOC(int, w);
-    int i, j;
-    memset(histogram, 0, w * sizeof(int));
-    for (i = 0; i < h; i++)
-        for (j = 0; j < w; j++)
-            if (pixels[i][j])
-                histogram[j]++;
+    int j;
+    for (j = 0; j < w; j++)
+        histogram[j] = projection_column_sum(p, j, 0, h - 1);
     return histogram;
 }
 
@@ -144,9 +141,18 @@ static int cut_into_window(int *histogram, int begin, int end)
 
 
 WordCut *cut_word(unsigned char **pixels, int w, int h)
+{
+    Projection p = create_projection_bw(pixels, 0, 0, w, h);
+    WordCut *wc = cut_word_in_projection(pixels, w, h, p);
+    free_projection(p);
+    return wc;
+}
+
+
+WordCut *cut_word_in_projection(unsigned char **pixels, int w, int h, Projection p)
 {
     unsigned char *projection = MALLOC(unsigned char, w);
-    int *histogram = make_histogram(pixels, w, h);
+    int *histogram = make_histogram(p, w, h);
     unsigned char *shields = MALLOC(unsigned char, w);
     WordCut *wc = MALLOC1(WordCut);
     
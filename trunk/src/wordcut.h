@@ -2,6 +2,9 @@
 #define PLASMA_OCR_WORDCUT_H
 
 
+#include "projection.h"
+
+
 typedef struct
 {
     int count;
@@ -14,6 +17,9 @@ typedef struct
 
 WordCut *cut_word(unsigned char **pixels, int w, int h);
 
+/* The same, reusing a black-and-white projection of the w * h pixels. */
+WordCut *cut_word_in_projection(unsigned char **pixels, int w, int h, Projection);
+
 void destroy_word_cut(WordCut *);
 
 